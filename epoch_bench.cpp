@@ -0,0 +1,865 @@
+// Microbenchmarks for the epoch reclaimer's hot paths.
+//
+//   epoch_bench [--benchmarks=a,b,...] [--threads=1,2,4] [--entries=0,64]
+//               [--ring=65536] [--read-pct=90] [--duration-ms=200]
+//               [--pin] [--asymmetric] [--json=FILE|-] [--pool=FILE]
+//               [--advance=ring[:SHIFT]|time:US|count:N|pressure]
+//               [--layout=spread|packed] [--managers=1] [--nodes=N]
+//               [--neutralize=LAG]
+//
+// Benchmarks (all run by default):
+//
+//   protect, guard      Protect()/Unprotect() and EpochGuard, cycling over
+//                       --managers EpochManagers, one per op.
+//   nested_guard        An EpochGuard inside another.
+//   push                GarbageList::Push() of a no-op item under a guard.
+//   push_batch          The same items GarbageList::kRetireBufferSize at a
+//                       time with PushBatch(); an op is an item.
+//   retire              The same items staged with Retire().
+//   sharded_push        push against a ShardedGarbageList with one ring per
+//                       CPU that together hold --ring items.
+//   bump                BumpCurrentEpoch().
+//   compute_safe_epoch  ComputeNewSafeToReclaimEpoch().
+//   mixed               Readers load a shared object under a guard, writers
+//                       replace and push it, in the ratio --read-pct.
+//   sweep, sweep_scalar GarbageList::Scavenge() over a full ring whose items
+//                       are not safe yet, with the vector and the scalar
+//                       epoch check (see GarbageList::SetVectorSweep()); an
+//                       op is a slot, and the time per MB is shown too.
+//   typed_push,         Retire() into a TypedGarbageList with removal epochs
+//   typed_push_split    interleaved with the pointers and in an array of
+//                       their own; an op is a call, also one that found the
+//                       ring full.
+//   parked_ebr,         mixed while one more reader stays parked in the
+//   parked_ibr          region it entered before the run, against a
+//                       GarbageList and an IntervalGarbageList; reports the
+//                       retired objects left unreclaimed at the end.
+//   mixed_scan          parked_ebr with a reader that keeps scanning inside
+//                       one restartable region (EPOCH_PROTECT_RESTARTABLE()).
+//   pool_alloc,         Allocate a 64-byte object and retire it, from and to
+//   malloc_alloc        an EpochPool, or with malloc() and free().
+//
+// Every selected benchmark runs once per combination of thread count and
+// table entry count. --entries registers that many extra, idle threads with
+// the EpochManager first, which is what scans in BumpCurrentEpoch() and
+// ComputeNewSafeToReclaimEpoch() pay for; only the first manager gets them.
+// --nodes gives every EpochManager that many per-node sub-tables instead of
+// one per NUMA node, spreading threads over them by CPU (see
+// EpochManager::Initialize()), which shows the cost of the per-node
+// summaries without a multi-socket machine. --neutralize=LAG lets the
+// EpochManager signal threads lagging more than LAG epochs behind to
+// restart (see EpochManager::EnableNeutralization()), which bounds the
+// garbage mixed_scan's reader holds back. --advance selects the epoch
+// advance policy (see EpochAdvancePolicy); the default is a bump every
+// quarter of the ring. --layout picks how the rings map tickets to slots
+// (see GarbageList::SetSlotSpread()). --pin pins worker i to CPU i % ncpus.
+// --json writes all results and the configuration they were taken with as
+// one JSON document to FILE (or stdout for "-") for comparing runs across
+// versions.
+//
+// In PMEM builds the garbage list benchmarks put the ring in a pmemobj pool
+// created at --pool (by default on /dev/shm, i.e. a DRAM stand-in for
+// persistent memory) and remove it afterwards.
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "epoch_manager.h"
+#include "epoch_pool.h"
+#include "garbage_list.h"
+#include "interval_garbage_list.h"
+#include "sharded_garbage_list.h"
+#include "typed_garbage_list.h"
+
+namespace {
+
+struct Options {
+  std::vector<std::string> benchmarks{"protect",      "guard",
+                                      "nested_guard", "push",
+                                      "push_batch",   "retire",
+                                      "sharded_push", "bump",
+                                      "compute_safe_epoch", "mixed",
+                                      "sweep",        "sweep_scalar",
+                                      "typed_push",   "typed_push_split",
+                                      "parked_ebr",   "parked_ibr",
+                                      "mixed_scan",   "pool_alloc",
+                                      "malloc_alloc"};
+  std::vector<uint64_t> threads{1};
+  std::vector<uint64_t> entries{0};
+  uint64_t ring = 64 * 1024;
+  uint64_t read_pct = 90;
+  uint64_t duration_ms = 200;
+  uint64_t managers = 1;
+  uint32_t nodes = 0;
+  uint64_t neutralize = 0;
+  bool pin = false;
+  bool asymmetric = false;
+  std::string json;
+  std::string pool = "/dev/shm/epoch_bench.pool";
+  std::string advance = "ring";
+  EpochAdvancePolicy advance_policy = EpochAdvancePolicy::RingFraction();
+  bool spread = true;
+};
+
+struct Result {
+  std::string benchmark;
+  uint64_t threads;
+  uint64_t entries;
+  uint64_t ops;
+  double seconds;
+  /// Ring bytes each op covers, for benchmarks that report time per MB.
+  uint64_t bytes_per_op = 0;
+  /// Retired objects left unreclaimed at the end, for benchmarks that
+  /// report it; -1 otherwise.
+  int64_t outstanding = -1;
+};
+
+std::vector<std::string> SplitList(const char* list) {
+  std::vector<std::string> items;
+  std::string item;
+  for (const char* c = list;; ++c) {
+    if (*c == ',' || *c == '\0') {
+      if (!item.empty()) items.push_back(item);
+      item.clear();
+      if (*c == '\0') break;
+    } else {
+      item += *c;
+    }
+  }
+  return items;
+}
+
+std::vector<uint64_t> SplitNumbers(const char* list) {
+  std::vector<uint64_t> numbers;
+  for (const std::string& item : SplitList(list)) {
+    numbers.push_back(strtoull(item.c_str(), nullptr, 10));
+  }
+  return numbers;
+}
+
+/// Parse an --advance value into \a policy.
+bool ParseAdvancePolicy(const std::string& spec, EpochAdvancePolicy* policy) {
+  std::string kind = spec.substr(0, spec.find(':'));
+  const char* arg = spec.find(':') == std::string::npos
+                        ? nullptr
+                        : spec.c_str() + spec.find(':') + 1;
+  uint64_t value = arg ? strtoull(arg, nullptr, 10) : 0;
+  if (kind == "ring") {
+    *policy = EpochAdvancePolicy::RingFraction(arg ? value : 2);
+  } else if (kind == "time" && value) {
+    *policy = EpochAdvancePolicy::Time(std::chrono::microseconds(value));
+  } else if (kind == "count" && IS_POWER_OF_TWO(value)) {
+    *policy = EpochAdvancePolicy::RetireCount(value);
+  } else if (kind == "pressure" && !arg) {
+    *policy = EpochAdvancePolicy::Pressure();
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = strchr(arg, '=');
+    value = value ? value + 1 : "";
+    if (!strncmp(arg, "--benchmarks=", 13)) {
+      options->benchmarks = SplitList(value);
+    } else if (!strncmp(arg, "--threads=", 10)) {
+      options->threads = SplitNumbers(value);
+    } else if (!strncmp(arg, "--entries=", 10)) {
+      options->entries = SplitNumbers(value);
+    } else if (!strncmp(arg, "--ring=", 7)) {
+      options->ring = strtoull(value, nullptr, 10);
+    } else if (!strncmp(arg, "--read-pct=", 11)) {
+      options->read_pct = strtoull(value, nullptr, 10);
+    } else if (!strncmp(arg, "--duration-ms=", 14)) {
+      options->duration_ms = strtoull(value, nullptr, 10);
+    } else if (!strncmp(arg, "--managers=", 11)) {
+      options->managers = strtoull(value, nullptr, 10);
+    } else if (!strncmp(arg, "--nodes=", 8)) {
+      options->nodes = strtoul(value, nullptr, 10);
+    } else if (!strncmp(arg, "--neutralize=", 13)) {
+      options->neutralize = strtoull(value, nullptr, 10);
+    } else if (!strcmp(arg, "--pin")) {
+      options->pin = true;
+    } else if (!strcmp(arg, "--asymmetric")) {
+      options->asymmetric = true;
+    } else if (!strncmp(arg, "--json=", 7)) {
+      options->json = value;
+    } else if (!strncmp(arg, "--pool=", 7)) {
+      options->pool = value;
+    } else if (!strncmp(arg, "--advance=", 10)) {
+      options->advance = value;
+      if (!ParseAdvancePolicy(value, &options->advance_policy)) {
+        fprintf(stderr, "bad --advance=%s\n", value);
+        return false;
+      }
+    } else if (!strncmp(arg, "--layout=", 9)) {
+      if (strcmp(value, "spread") && strcmp(value, "packed")) {
+        fprintf(stderr, "bad --layout=%s\n", value);
+        return false;
+      }
+      options->spread = !strcmp(value, "spread");
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return false;
+    }
+  }
+  if (!IS_POWER_OF_TWO(options->ring) || options->read_pct > 100) {
+    fprintf(stderr, "--ring must be a power of two, --read-pct at most 100\n");
+    return false;
+  }
+  if (!options->managers ||
+      options->managers > EpochManager::MinEpochTable::kMaxTables) {
+    fprintf(stderr, "--managers must be between 1 and %u\n",
+            EpochManager::MinEpochTable::kMaxTables);
+    return false;
+  }
+  return true;
+}
+
+void PinToCpu(uint64_t index) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(index % (cpus > 0 ? cpus : 1), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/// Threads that each take an entry in \a manager's table and then stay
+/// alive, unprotected, until destroyed.
+class IdleEntries {
+ public:
+  IdleEntries(EpochManager* manager, uint64_t count) : release_{false} {
+    std::atomic<uint64_t> registered{0};
+    for (uint64_t i = 0; i < count; ++i) {
+      threads_.emplace_back([this, manager, &registered] {
+        manager->Protect();
+        manager->Unprotect();
+        registered.fetch_add(1);
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return release_; });
+      });
+    }
+    while (registered.load() < count) std::this_thread::yield();
+  }
+  ~IdleEntries() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      release_ = true;
+    }
+    cv_.notify_all();
+    for (std::thread& thread : threads_) thread.join();
+  }
+
+ private:
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool release_;
+};
+
+/// A thread that sits in a protected region for as long as the ParkedReader
+/// exists. \a reader runs on it; it must protect, call Parked(), and then
+/// either block in WaitForRelease() or keep reading until Released().
+class ParkedReader {
+ public:
+  explicit ParkedReader(const std::function<void(ParkedReader*)>& reader)
+      : parked_{false}, release_{false} {
+    thread_ = std::thread([this, reader] { reader(this); });
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return parked_; });
+  }
+  ~ParkedReader() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      release_.store(true);
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  void Parked() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    parked_ = true;
+    cv_.notify_all();
+  }
+  void WaitForRelease() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return release_.load(); });
+  }
+  bool Released() { return release_.load(std::memory_order_relaxed); }
+
+ private:
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool parked_;
+  std::atomic<bool> release_;
+};
+
+/// Run \a body on \a threads workers until the duration expires; \a body
+/// performs a batch of operations and returns how many.
+Result RunTimed(const Options& options, const std::string& name,
+                uint64_t threads, uint64_t entries,
+                const std::function<uint64_t(uint64_t)>& body) {
+  std::atomic<bool> start{false};
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> ready{0};
+  std::atomic<uint64_t> total{0};
+  std::vector<std::thread> workers;
+  for (uint64_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      if (options.pin) PinToCpu(t);
+      ready.fetch_add(1);
+      while (!start.load(std::memory_order_acquire)) std::this_thread::yield();
+      uint64_t ops = 0;
+      while (!stop.load(std::memory_order_relaxed)) ops += body(t);
+      total.fetch_add(ops);
+    });
+  }
+  while (ready.load() < threads) std::this_thread::yield();
+
+  auto begin = std::chrono::steady_clock::now();
+  start.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_ms));
+  stop.store(true);
+  for (std::thread& worker : workers) worker.join();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+  return Result{name, threads, entries, total.load(), seconds};
+}
+
+const uint64_t kBatch = 1024;
+
+void NoDestroy(void* context, void* object) {
+  (void)context;
+  (void)object;
+}
+
+/// TypedGarbageList counterpart of NoDestroy.
+struct NoDelete {
+  void operator()(char* object) const { (void)object; }
+};
+
+void FreeObject(void* context, void* object) {
+  (void)context;
+  free(object);
+}
+
+/// Cacheline-sized object allocated and retired by pool_alloc and
+/// malloc_alloc.
+struct Payload {
+  uint64_t words[8];
+};
+
+/// Object replaced and retired by parked_ebr and parked_ibr.
+struct Node {
+  uint64_t value;
+  IntervalGarbageList::Era birth_era;
+};
+
+Result RunBenchmark(const Options& options, const std::string& name,
+                    uint64_t threads, uint64_t entries) {
+  EpochManager manager;
+  manager.Initialize(options.asymmetric, options.nodes);
+  manager.SetAdvancePolicy(options.advance_policy);
+  if (options.neutralize) manager.EnableNeutralization(options.neutralize);
+  IdleEntries idle(&manager, entries);
+
+  if ((name == "protect" || name == "guard") && options.managers > 1) {
+    // Every op moves on to the next of --managers managers, as a thread
+    // working on that many shards with a manager each would.
+    std::vector<EpochManager> others(options.managers - 1);
+    std::vector<EpochManager*> managers{&manager};
+    for (EpochManager& other : others) {
+      other.Initialize(options.asymmetric, options.nodes);
+      other.SetAdvancePolicy(options.advance_policy);
+      managers.push_back(&other);
+    }
+    bool use_guard = name == "guard";
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      size_t next = 0;
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        EpochManager* current = managers[next];
+        if (++next == managers.size()) next = 0;
+        if (use_guard) {
+          EpochGuard guard(current);
+        } else {
+          current->Protect();
+          current->Unprotect();
+        }
+      }
+      return kBatch;
+    });
+  }
+  if (name == "protect") {
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        manager.Protect();
+        manager.Unprotect();
+      }
+      return kBatch;
+    });
+  }
+  if (name == "guard") {
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        EpochGuard guard(&manager);
+      }
+      return kBatch;
+    });
+  }
+  if (name == "nested_guard") {
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      EpochGuard outer(&manager);
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        EpochGuard guard(&manager);
+      }
+      return kBatch;
+    });
+  }
+  if (name == "bump") {
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      for (uint64_t i = 0; i < kBatch; ++i) manager.BumpCurrentEpoch();
+      return kBatch;
+    });
+  }
+  if (name == "compute_safe_epoch") {
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        manager.ComputeNewSafeToReclaimEpoch(manager.GetCurrentEpoch());
+      }
+      return kBatch;
+    });
+  }
+
+  if (name == "typed_push" || name == "typed_push_split") {
+    // Same as push; TypedGarbageList lives in DRAM in every build.
+    static char dummy;
+    auto run = [&](auto* typed) {
+      typed->Initialize(&manager, options.ring);
+      typed->SetSlotSpread(options.spread);
+      return RunTimed(options, name, threads, entries, [&](uint64_t) {
+        for (uint64_t i = 0; i < kBatch; ++i) {
+          EpochGuard guard(&manager);
+          typed->Retire(&dummy);
+        }
+        return kBatch;
+      });
+    };
+    if (name == "typed_push") {
+      TypedGarbageList<char, NoDelete> typed;
+      return run(&typed);
+    }
+    TypedGarbageList<char, NoDelete, true> typed;
+    return run(&typed);
+  }
+
+  if (name == "parked_ibr") {
+    // parked_ebr against an IntervalGarbageList: the parked reader only
+    // holds back the node it read, not everything retired after it.
+    IntervalGarbageList ibr;
+    ibr.Initialize(nullptr, threads + 1);
+    Node* first = static_cast<Node*>(malloc(sizeof(Node)));
+    *first = Node{0, ibr.OnAllocate()};
+    std::atomic<Node*> shared{first};
+    Result result;
+    {
+      ParkedReader parked([&](ParkedReader* reader) {
+        IntervalGuard guard(&ibr);
+        guard.Read(shared);
+        reader->Parked();
+        reader->WaitForRelease();
+      });
+      std::vector<uint64_t> seeds(threads);
+      for (uint64_t t = 0; t < threads; ++t) seeds[t] = t + 1;
+      result = RunTimed(options, name, threads, entries, [&](uint64_t t) {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < kBatch; ++i) {
+          seeds[t] = Murmur3_64(seeds[t]);
+          IntervalGuard guard(&ibr);
+          if (seeds[t] % 100 < options.read_pct) {
+            sum += guard.Read(shared)->value;
+          } else {
+            Node* fresh = static_cast<Node*>(malloc(sizeof(Node)));
+            *fresh = Node{i, ibr.OnAllocate()};
+            Node* old = shared.exchange(fresh);
+            ibr.Push(old, old->birth_era, FreeObject, nullptr);
+          }
+        }
+        static std::atomic<uint64_t> sink;
+        sink.fetch_add(sum, std::memory_order_relaxed);
+        return kBatch;
+      });
+      result.outstanding = ibr.GetOutstanding();
+    }
+    ibr.Uninitialize();
+    free(shared.load());
+    return result;
+  }
+
+#ifdef PMEM
+  unlink(options.pool.c_str());
+  size_t pool_size = sizeof(GarbageList::Item) * options.ring * 2;
+  if (pool_size < PMEMOBJ_MIN_POOL) pool_size = PMEMOBJ_MIN_POOL;
+  PMEMobjpool* pool =
+      pmemobj_create(options.pool.c_str(), POBJ_LAYOUT_NAME(garbagelist),
+                     pool_size, very_pm::CREATE_MODE_RW);
+  if (!pool) {
+    perror(options.pool.c_str());
+    return Result{name, threads, entries, 0, 0};
+  }
+  struct PoolCloser {
+    PMEMobjpool* pool;
+    const char* path;
+    ~PoolCloser() {
+      pmemobj_close(pool);
+      unlink(path);
+    }
+  } closer{pool, options.pool.c_str()};
+#endif
+  if (name == "sharded_push") {
+    // push, against one ring per CPU sharing --ring slots.
+    static char dummy;
+    ShardedGarbageList sharded;
+#ifdef PMEM
+    sharded.Initialize(&manager, pool, options.ring);
+#else
+    sharded.Initialize(&manager, options.ring);
+#endif
+    sharded.SetSlotSpread(options.spread);
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        EpochGuard guard(&manager);
+        sharded.Push(&dummy, NoDestroy, nullptr);
+      }
+      return kBatch;
+    });
+  }
+
+  // Declared after the pool so that it is uninitialized before the pool
+  // goes away.
+  GarbageList list;
+#ifdef PMEM
+  list.Initialize(&manager, pool, options.ring);
+#else
+  list.Initialize(&manager, options.ring);
+#endif
+  list.SetSlotSpread(options.spread);
+
+  if (name == "push") {
+    // Pushes a dummy object with a no-op callback so only the list is
+    // measured, not the allocator.
+    static char dummy;
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        EpochGuard guard(&manager);
+        list.Push(&dummy, NoDestroy, nullptr);
+      }
+      return kBatch;
+    });
+  }
+  if (name == "push_batch") {
+    // push, one GarbageList::PushBatch() of kRetireBufferSize items per
+    // guard; an op is an item.
+    static char dummy;
+    GarbageList::Item items[GarbageList::kRetireBufferSize];
+    for (GarbageList::Item& item : items) {
+      item = GarbageList::Item{0, NoDestroy, nullptr, &dummy};
+    }
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      for (uint64_t i = 0; i < kBatch; i += GarbageList::kRetireBufferSize) {
+        EpochGuard guard(&manager);
+        list.PushBatch(items, GarbageList::kRetireBufferSize);
+      }
+      return kBatch;
+    });
+  }
+  if (name == "retire") {
+    // push through the calling thread's retire buffer, which is published
+    // when it fills up or the guard is left.
+    static char dummy;
+    return RunTimed(options, name, threads, entries, [&](uint64_t) {
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        EpochGuard guard(&manager);
+        list.Retire(&dummy, NoDestroy, nullptr);
+      }
+      return kBatch;
+    });
+  }
+  if (name == "pool_alloc" || name == "malloc_alloc") {
+    // Every op allocates an object and retires it to the list, whose
+    // pushers reclaim older ones: through an EpochPool attached to the
+    // list, or with malloc() and a destroy callback that calls free().
+    EpochPool<Payload> pool;
+    pool.Initialize();
+    pool.Attach(&list);
+    bool pooled = name == "pool_alloc";
+    Result result = RunTimed(options, name, threads, entries, [&](uint64_t) {
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        EpochGuard guard(&manager);
+        if (pooled) {
+          pool.Retire(&list, pool.Allocate(Payload{{i}}));
+        } else {
+          Payload* payload = static_cast<Payload*>(malloc(sizeof(Payload)));
+          *payload = Payload{{i}};
+          list.Push(payload, FreeObject, nullptr);
+        }
+      }
+      return kBatch;
+    });
+    // Objects still on the list go back to the pool, so before it.
+    list.Uninitialize();
+    return result;
+  }
+  if (name == "sweep" || name == "sweep_scalar") {
+    // A guard taken before the ring is filled keeps every item unsafe, so each
+    // Scavenge() slice scans without destroying anything; that is what
+    // idle-time scavenging does most of the time, and the CAS-and-destroy
+    // path is the same with either epoch check.
+    if (!list.SetVectorSweep(name == "sweep")) {
+      fprintf(stderr, "%s: no vector sweep in this build\n", name.c_str());
+      return Result{name, threads, entries, 0, 0};
+    }
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool holding = false;
+    bool release = false;
+    std::thread holder([&] {
+      EpochGuard guard(&manager);
+      std::unique_lock<std::mutex> lock(mutex);
+      holding = true;
+      cv.notify_all();
+      cv.wait(lock, [&] { return release; });
+    });
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return holding; });
+    }
+    static char dummy;
+    for (uint64_t i = 0; i < options.ring; ++i) {
+      list.Push(&dummy, NoDestroy, nullptr);
+    }
+    Result result = RunTimed(options, name, threads, entries, [&](uint64_t) {
+      list.Scavenge(kBatch);
+      return kBatch;
+    });
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      release = true;
+    }
+    cv.notify_all();
+    holder.join();
+    result.bytes_per_op = sizeof(GarbageList::Item);
+    return result;
+  }
+  if (name == "parked_ebr" || name == "mixed_scan") {
+    // mixed while one more thread stays in the guard it read the shared
+    // object under (parked_ebr) or keeps reading it in one long restartable
+    // scan (mixed_scan). Nothing retired after it entered can be reclaimed
+    // unless it is neutralized, so the ring and then the overflow fill up;
+    // pushes that fail once the overflow is at its limit keep their objects
+    // aside until the end.
+    Node* first = static_cast<Node*>(malloc(sizeof(Node)));
+    *first = Node{0, 0};
+    std::atomic<Node*> shared{first};
+    std::vector<std::vector<Node*>> unpushed(threads);
+    Result result;
+    {
+      ParkedReader parked([&](ParkedReader* reader) {
+        if (name == "parked_ebr") {
+          EpochGuard guard(&manager);
+          shared.load(std::memory_order_acquire);
+          reader->Parked();
+          reader->WaitForRelease();
+          return;
+        }
+        EpochManager::RestartPoint point;
+        volatile bool started = false;
+        volatile uint64_t sum = 0;
+        EPOCH_PROTECT_RESTARTABLE(&manager, &point);
+        if (!started) {
+          // Taking the mutex must not be cut short by a restart.
+          point.Disarm();
+          started = true;
+          reader->Parked();
+          point.Arm();
+        }
+        while (!reader->Released()) {
+          sum = sum + shared.load(std::memory_order_acquire)->value;
+        }
+        manager.UnprotectRestartable(&point);
+      });
+      std::vector<uint64_t> seeds(threads);
+      for (uint64_t t = 0; t < threads; ++t) seeds[t] = t + 1;
+      result = RunTimed(options, name, threads, entries, [&](uint64_t t) {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < kBatch; ++i) {
+          seeds[t] = Murmur3_64(seeds[t]);
+          EpochGuard guard(&manager);
+          if (seeds[t] % 100 < options.read_pct) {
+            sum += shared.load(std::memory_order_acquire)->value;
+          } else {
+            Node* fresh = static_cast<Node*>(malloc(sizeof(Node)));
+            *fresh = Node{i, 0};
+            Node* old = shared.exchange(fresh);
+            if (!list.Push(old, FreeObject, nullptr)) {
+              unpushed[t].push_back(old);
+            }
+          }
+        }
+        static std::atomic<uint64_t> sink;
+        sink.fetch_add(sum, std::memory_order_relaxed);
+        return kBatch;
+      });
+      ReclamationStats stats;
+      list.GetStats(&stats);
+      result.outstanding = stats.outstanding;
+      for (const std::vector<Node*>& nodes : unpushed) {
+        result.outstanding += nodes.size();
+      }
+    }
+    list.Uninitialize();
+    for (const std::vector<Node*>& nodes : unpushed) {
+      for (Node* node : nodes) free(node);
+    }
+    free(shared.load());
+    return result;
+  }
+  if (name == "mixed") {
+    // Readers load a shared pointer under a guard; writers replace it and
+    // retire the old object, in the ratio given by --read-pct.
+    std::atomic<uint64_t*> shared{static_cast<uint64_t*>(malloc(64))};
+    std::vector<uint64_t> seeds(threads);
+    for (uint64_t t = 0; t < threads; ++t) seeds[t] = t + 1;
+    Result result = RunTimed(options, name, threads, entries, [&](uint64_t t) {
+      uint64_t sum = 0;
+      for (uint64_t i = 0; i < kBatch; ++i) {
+        seeds[t] = Murmur3_64(seeds[t]);
+        EpochGuard guard(&manager);
+        if (seeds[t] % 100 < options.read_pct) {
+          sum += *shared.load(std::memory_order_acquire);
+        } else {
+          uint64_t* fresh = static_cast<uint64_t*>(malloc(64));
+          *fresh = i;
+          list.Push(shared.exchange(fresh), FreeObject, nullptr);
+        }
+      }
+      static std::atomic<uint64_t> sink;
+      sink.fetch_add(sum, std::memory_order_relaxed);
+      return kBatch;
+    });
+    list.Uninitialize();
+    free(shared.load());
+    return result;
+  }
+
+  fprintf(stderr, "unknown benchmark %s\n", name.c_str());
+  return Result{name, threads, entries, 0, 0};
+}
+
+void WriteJson(FILE* out, const Options& options,
+               const std::vector<Result>& results) {
+  fprintf(out, "{\n  \"config\": {\n");
+#ifdef PMEM
+  fprintf(out, "    \"pmem\": true,\n");
+#else
+  fprintf(out, "    \"pmem\": false,\n");
+#endif
+#ifdef EPOCH_STATS
+  fprintf(out, "    \"stats\": true,\n");
+#else
+  fprintf(out, "    \"stats\": false,\n");
+#endif
+  fprintf(out, "    \"asymmetric_fences\": %s,\n",
+          options.asymmetric ? "true" : "false");
+  fprintf(out, "    \"pinned\": %s,\n", options.pin ? "true" : "false");
+  fprintf(out, "    \"managers\": %lu,\n", options.managers);
+  fprintf(out, "    \"nodes\": %u,\n", options.nodes);
+  fprintf(out, "    \"neutralize\": %lu,\n", options.neutralize);
+  fprintf(out, "    \"advance\": \"%s\",\n", options.advance.c_str());
+  fprintf(out, "    \"ring\": %lu,\n", options.ring);
+  fprintf(out, "    \"layout\": \"%s\",\n",
+          options.spread ? "spread" : "packed");
+  fprintf(out, "    \"read_pct\": %lu,\n", options.read_pct);
+  fprintf(out, "    \"duration_ms\": %lu,\n", options.duration_ms);
+  fprintf(out, "    \"cpus\": %ld\n  },\n", sysconf(_SC_NPROCESSORS_ONLN));
+  fprintf(out, "  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    double mops = r.seconds > 0 ? r.ops / r.seconds / 1e6 : 0;
+    double ns = r.ops ? r.seconds * 1e9 * r.threads / r.ops : 0;
+    fprintf(out,
+            "    {\"benchmark\": \"%s\", \"threads\": %lu, \"entries\": %lu, "
+            "\"ops\": %lu, \"seconds\": %.6f, \"mops\": %.3f, "
+            "\"ns_per_op\": %.3f",
+            r.benchmark.c_str(), r.threads, r.entries, r.ops, r.seconds, mops,
+            ns);
+    if (r.bytes_per_op) {
+      fprintf(out, ", \"us_per_mb\": %.3f",
+              ns * (1 << 20) / r.bytes_per_op / 1e3);
+    }
+    if (r.outstanding >= 0) {
+      fprintf(out, ", \"outstanding\": %ld", r.outstanding);
+    }
+    fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) return 1;
+
+  std::vector<Result> results;
+  bool human = options.json != "-";
+  if (human) {
+    printf("%-20s %8s %8s %12s %10s\n", "benchmark", "threads", "entries",
+           "Mops/s", "ns/op");
+  }
+  for (const std::string& name : options.benchmarks) {
+    for (uint64_t entries : options.entries) {
+      for (uint64_t threads : options.threads) {
+        Result r = RunBenchmark(options, name, threads, entries);
+        results.push_back(r);
+        if (human && r.ops) {
+          double ns = r.seconds * 1e9 * threads / r.ops;
+          printf("%-20s %8lu %8lu %12.3f %10.2f", name.c_str(), threads,
+                 entries, r.ops / r.seconds / 1e6, ns);
+          if (r.bytes_per_op) {
+            printf("  (%.1f us/MB)", ns * (1 << 20) / r.bytes_per_op / 1e3);
+          }
+          if (r.outstanding >= 0) printf("  (%ld outstanding)", r.outstanding);
+          printf("\n");
+        }
+      }
+    }
+  }
+
+  if (!options.json.empty()) {
+    FILE* out = human ? fopen(options.json.c_str(), "w") : stdout;
+    if (!out) {
+      perror(options.json.c_str());
+      return 1;
+    }
+    WriteJson(out, options, results);
+    if (out != stdout) fclose(out);
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <type_traits>
+#include "garbage_list.h"
+
+/// Lock-free hash map with a fixed number of buckets, each a sorted
+/// Harris-Michael linked list, whose removed nodes are reclaimed through a
+/// GarbageList.
+///
+/// Removal first marks the low bit of the victim's next pointer (logical
+/// delete) and then unlinks it; any traversal that runs into a marked node
+/// helps unlink it, and whoever unlinks a node retires it. Every operation
+/// runs inside an EpochGuard, so a traversal may keep walking through nodes
+/// that were unlinked under it.
+///
+/// Keys and values must be trivially copyable; values are stored in a
+/// std::atomic so Update() can replace them in place.
+template <typename K, typename V>
+class EpochHashMap {
+  static_assert(std::is_trivially_copyable<K>::value &&
+                    std::is_trivially_copyable<V>::value,
+                "keys and values must be trivially copyable");
+
+ public:
+  EpochHashMap()
+      : buckets_{}, bucket_count_{}, size_{}, epoch_manager_{},
+        garbage_list_{} {}
+  ~EpochHashMap() { Uninitialize(); }
+
+  EpochHashMap(const EpochHashMap&) = delete;
+  EpochHashMap& operator=(const EpochHashMap&) = delete;
+
+  /// Create \a bucket_count buckets (a power of two) and use
+  /// \a garbage_list, which must be initialized with \a epoch_manager, to
+  /// reclaim removed nodes.
+  bool Initialize(EpochManager* epoch_manager, GarbageList* garbage_list,
+                  size_t bucket_count) {
+    if (epoch_manager_) return true;
+    if (!epoch_manager || !garbage_list) return false;
+    if (!IS_POWER_OF_TWO(bucket_count)) return false;
+
+    void* mem = nullptr;
+    if (posix_memalign(&mem, very_pm::kCacheLineSize,
+                       sizeof(std::atomic<Node*>) * bucket_count)) {
+      return false;
+    }
+    buckets_ = static_cast<std::atomic<Node*>*>(mem);
+    for (size_t i = 0; i < bucket_count; ++i) {
+      new (&buckets_[i]) std::atomic<Node*>{nullptr};
+    }
+    bucket_count_ = bucket_count;
+    size_.store(0, std::memory_order_relaxed);
+    epoch_manager_ = epoch_manager;
+    garbage_list_ = garbage_list;
+    return true;
+  }
+
+  /// Delete every node still linked. No thread may use the map any more.
+  bool Uninitialize() {
+    if (!epoch_manager_) return true;
+    for (size_t i = 0; i < bucket_count_; ++i) {
+      Node* node = buckets_[i].load(std::memory_order_relaxed);
+      while (node) {
+        Node* next = Unmark(node->next.load(std::memory_order_relaxed));
+        delete node;
+        node = next;
+      }
+    }
+    free(buckets_);
+    buckets_ = nullptr;
+    bucket_count_ = 0;
+    epoch_manager_ = nullptr;
+    garbage_list_ = nullptr;
+    return true;
+  }
+
+  /// Look up \a key and copy its value to \a value.
+  /// \retval false \a key is not in the map.
+  bool Get(const K& key, V* value) {
+    EpochGuard guard(epoch_manager_);
+    // Read-only walk: marked nodes are skipped rather than unlinked.
+    Node* node = BucketFor(key).load(std::memory_order_acquire);
+    while (node && node->key < key) {
+      node = Unmark(node->next.load(std::memory_order_acquire));
+    }
+    if (!node || node->key != key ||
+        IsMarked(node->next.load(std::memory_order_acquire))) {
+      return false;
+    }
+    *value = node->value.load(std::memory_order_acquire);
+    return true;
+  }
+
+  /// Add \a key with \a value.
+  /// \retval false \a key was already in the map; nothing changed.
+  bool Insert(const K& key, const V& value) {
+    Node* node = new Node{key, value, nullptr};
+    PendingRetires pending(garbage_list_);
+    EpochGuard guard(epoch_manager_);
+    for (;;) {
+      std::atomic<Node*>* prev;
+      Node* curr;
+      if (Find(key, &prev, &curr, &pending)) {
+        delete node;
+        return false;
+      }
+      node->next.store(curr, std::memory_order_relaxed);
+      if (prev->compare_exchange_strong(curr, node, std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+        size_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+
+  /// Replace the value of \a key with \a value.
+  /// \retval false \a key is not in the map.
+  bool Update(const K& key, const V& value) {
+    PendingRetires pending(garbage_list_);
+    EpochGuard guard(epoch_manager_);
+    std::atomic<Node*>* prev;
+    Node* curr;
+    if (!Find(key, &prev, &curr, &pending)) return false;
+    curr->value.store(value, std::memory_order_release);
+    return true;
+  }
+
+  /// Remove \a key.
+  /// \retval false \a key is not in the map.
+  bool Remove(const K& key) {
+    PendingRetires pending(garbage_list_);
+    EpochGuard guard(epoch_manager_);
+    for (;;) {
+      std::atomic<Node*>* prev;
+      Node* curr;
+      if (!Find(key, &prev, &curr, &pending)) return false;
+      Node* next = curr->next.load(std::memory_order_acquire);
+      if (IsMarked(next)) continue;
+      // Logically delete; from here on only the unlinker may retire it.
+      if (!curr->next.compare_exchange_weak(next, Mark(next),
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+        continue;
+      }
+      size_.fetch_sub(1, std::memory_order_relaxed);
+      Node* expected = curr;
+      if (prev->compare_exchange_strong(expected, next,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+        Retire(curr, &pending);
+      } else {
+        // Someone changed prev; let a fresh traversal unlink it.
+        Find(key, &prev, &curr, &pending);
+      }
+      return true;
+    }
+  }
+
+  /// Number of keys in the map; approximate while it is being modified.
+  size_t GetSize() const { return size_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Node {
+    K key;
+    std::atomic<V> value;
+
+    /// Successor; the low bit is set once this node is logically deleted.
+    std::atomic<Node*> next;
+  };
+
+  static bool IsMarked(Node* node) {
+    return reinterpret_cast<uintptr_t>(node) & 1;
+  }
+  static Node* Mark(Node* node) {
+    return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(node) | 1);
+  }
+  static Node* Unmark(Node* node) {
+    return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(node) & ~1ull);
+  }
+
+  std::atomic<Node*>& BucketFor(const K& key) {
+    return buckets_[std::hash<K>{}(key) & (bucket_count_ - 1)];
+  }
+
+  /// Locate \a key in its bucket, unlinking (and retiring) marked nodes on
+  /// the way. On return \a *curr is the first node with a key not less than
+  /// \a key (or nullptr) and \a *prev the unmarked link pointing at it.
+  /// Must be called while protected, with \a pending declared before the
+  /// guard. Returns true if \a *curr holds \a key.
+  bool Find(const K& key, std::atomic<Node*>** prev, Node** curr,
+            PendingRetires* pending) {
+  retry:
+    std::atomic<Node*>* link = &BucketFor(key);
+    Node* node = link->load(std::memory_order_acquire);
+    for (;;) {
+      if (!node) break;
+      Node* next = node->next.load(std::memory_order_acquire);
+      if (IsMarked(next)) {
+        Node* expected = node;
+        if (!link->compare_exchange_strong(expected, Unmark(next),
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+          goto retry;
+        }
+        Retire(node, pending);
+        node = Unmark(next);
+        continue;
+      }
+      if (!(node->key < key)) break;
+      link = &node->next;
+      node = next;
+    }
+    *prev = link;
+    *curr = node;
+    return node && node->key == key;
+  }
+
+  /// Hand an unlinked node to the garbage list; staged while protected and
+  /// published when the caller's guard goes away, or left in \a pending if
+  /// the list refuses it.
+  void Retire(Node* node, PendingRetires* pending) {
+    pending->Retire(node, &EpochHashMap::DestroyNode, nullptr);
+  }
+
+  static void DestroyNode(void* context, void* node) {
+    (void)context;
+    delete static_cast<Node*>(node);
+  }
+
+  std::atomic<Node*>* buckets_;
+  size_t bucket_count_;
+  std::atomic<size_t> size_;
+  EpochManager* epoch_manager_;
+  GarbageList* garbage_list_;
+};
@@ -1,7 +1,27 @@
 #include "epoch_manager.h"
+#include <immintrin.h>
+#include <linux/membarrier.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
 
 EpochManager::EpochManager()
-    : current_epoch_{1}, safe_to_reclaim_epoch_{0}, epoch_table_{nullptr} {}
+    : epoch_table_{nullptr},
+      advance_policy_{EpochAdvancePolicy::RingFraction()},
+      neutralize_lag_{0},
+      neutralize_signal_{0},
+      current_epoch_{1},
+      safe_to_reclaim_epoch_{0},
+      scan_requested_{0},
+      scanning_{false},
+      last_advance_ns_{0},
+      last_refresh_ns_{0},
+      pressure_shift_{EpochAdvancePolicy::kMinPressureShift},
+      pressure_blocked_{false} {}
 
 EpochManager::~EpochManager() { Uninitialize(); }
 
@@ -10,23 +30,47 @@ EpochManager::~EpochManager() { Uninitialize(); }
  * it is safe to use an instance via any other members. Calling this on an
  * initialized instance has no effect.
  *
+ * \param asymmetric_fences Move the cost of ordering Protect() against
+ *      later reads from every reader onto the reclaiming side: Protect()
+ *      skips its full fence and ComputeNewSafeToReclaimEpoch() issues a
+ *      process-wide membarrier() instead. Pays off for read-mostly
+ *      workloads where bumps are rare. Silently falls back to fenced
+ *      Protect() if the kernel lacks private expedited membarrier; see
+ *      UsesAsymmetricFences().
+ * \param nodes Number of per-node sub-tables to keep; 0 (the default) for
+ *      one per NUMA node of the machine. Any other count is emulated by
+ *      spreading threads over the sub-tables by CPU, which lets the
+ *      hierarchical scan be exercised (or benchmarked) on a single socket.
+ *
  * \retval S_OK Initialization was successful and instance is ready for use.
  * \retval S_FALSE This instance was already initialized; no action was taken.
  * \retval E_OUTOFMEMORY Initialization failed due to lack of heap space, the
  *      instance was left safely in an uninitialized state.
  */
-bool EpochManager::Initialize() {
+bool EpochManager::Initialize(bool asymmetric_fences, uint32_t nodes) {
   if (epoch_table_) return true;
 
   MinEpochTable* new_table = new MinEpochTable();
 
   if (new_table == nullptr) return false;
 
-  auto rv = new_table->Initialize();
+  auto rv = new_table->Initialize(MinEpochTable::kDefaultSize, nodes,
+                                  asymmetric_fences);
   if (!rv) return rv;
 
   current_epoch_ = 1;
   safe_to_reclaim_epoch_ = 0;
+  scan_requested_.store(0, std::memory_order_relaxed);
+  scanning_.store(false, std::memory_order_relaxed);
+  last_advance_ns_.store(NowNanoseconds(), std::memory_order_relaxed);
+  last_refresh_ns_.store(0, std::memory_order_relaxed);
+#ifdef EPOCH_STATS
+  stats_.Reset();
+  for (auto& time : epoch_start_times_) {
+    time.store(0, std::memory_order_relaxed);
+  }
+  epoch_start_times_[1].store(StatNanoseconds(), std::memory_order_relaxed);
+#endif
   epoch_table_ = new_table;
 
   return true;
@@ -78,9 +122,239 @@ bool EpochManager::Uninitialize() {
  *
  * Only called by GarbageList.
  */
+bool EpochManager::UsesAsymmetricFences() {
+  return epoch_table_->UsesAsymmetricFences();
+}
+
 void EpochManager::BumpCurrentEpoch() {
-  Epoch newEpoch = current_epoch_.fetch_add(1, std::memory_order_seq_cst);
-  ComputeNewSafeToReclaimEpoch(newEpoch);
+  OnEpochAdvanced(current_epoch_.fetch_add(1, std::memory_order_seq_cst));
+}
+
+void EpochManager::OnEpochAdvanced(Epoch newEpoch) {
+  uint64_t now = NowNanoseconds();
+  last_advance_ns_.store(now, std::memory_order_relaxed);
+  last_refresh_ns_.store(now, std::memory_order_relaxed);
+  if (advance_policy_.kind == EpochAdvancePolicy::kPressure &&
+      !pressure_blocked_.exchange(false, std::memory_order_relaxed)) {
+    uint32_t shift = pressure_shift_.load(std::memory_order_relaxed);
+    if (shift > EpochAdvancePolicy::kMinPressureShift) {
+      pressure_shift_.store(shift - 1, std::memory_order_relaxed);
+    }
+  }
+  EPOCH_STAT(stats_.Add(kStatEpochBumps));
+  EPOCH_STAT(epoch_start_times_[(newEpoch + 1) % kEpochTimes].store(
+      StatNanoseconds(), std::memory_order_relaxed));
+  CoalescedComputeSafeEpoch(newEpoch);
+
+  if (neutralize_lag_ && newEpoch > neutralize_lag_ &&
+      safe_to_reclaim_epoch_.load(std::memory_order_relaxed) <
+          newEpoch - neutralize_lag_) {
+    uint64_t signalled = epoch_table_->SignalLaggingThreads(
+        newEpoch - neutralize_lag_, neutralize_signal_);
+    EPOCH_STAT(stats_.Add(kStatNeutralizeSignals, signalled));
+    (void)signalled;
+  }
+}
+
+bool EpochManager::SetAdvancePolicy(const EpochAdvancePolicy& policy) {
+  switch (policy.kind) {
+    case EpochAdvancePolicy::kRingFraction:
+      if (policy.ring_shift >= 64) return false;
+      break;
+    case EpochAdvancePolicy::kTime:
+      if (policy.interval.count() <= 0) return false;
+      break;
+    case EpochAdvancePolicy::kRetireCount:
+      if (!IS_POWER_OF_TWO(policy.retire_count)) return false;
+      break;
+    case EpochAdvancePolicy::kPressure:
+      break;
+    case EpochAdvancePolicy::kCustom:
+      if (!policy.callback) return false;
+      break;
+    default:
+      return false;
+  }
+  if (policy.min_refresh_interval.count() < 0) return false;
+  advance_policy_ = policy;
+  pressure_shift_.store(EpochAdvancePolicy::kMinPressureShift,
+                        std::memory_order_relaxed);
+  pressure_blocked_.store(false, std::memory_order_relaxed);
+  return true;
+}
+
+bool EpochManager::TimeToAdvance() {
+  uint64_t last = last_advance_ns_.load(std::memory_order_relaxed);
+  uint64_t now = NowNanoseconds();
+  if (now - last < (uint64_t)advance_policy_.interval.count()) return false;
+  // Many pushers may notice at once; only the one that moves the timestamp
+  // bumps, the bump itself stores the final value.
+  return last_advance_ns_.compare_exchange_strong(last, now,
+                                                  std::memory_order_relaxed);
+}
+
+/**
+ * Give a pusher stuck on an item of \a epoch a fresh look at the table
+ * instead of making it wait for the next bump. Scans are rate limited: the
+ * last bump or refresh must be at least min_refresh_interval ago, and the
+ * caller that moves #last_refresh_ns_ forward is the only one to scan, so a
+ * crowd of pushers hitting the same unsafe stretch of the ring costs one
+ * scan. Items of the current epoch can not become safe without a bump;
+ * under kPressure the first pusher to find one makes that bump, and the
+ * first pusher held up in an epoch raises the bump rate.
+ */
+bool EpochManager::RefreshSafeToReclaimEpoch(Epoch epoch) {
+  if (IsSafeToReclaim(epoch)) return true;
+
+  bool pressure = advance_policy_.kind == EpochAdvancePolicy::kPressure;
+  if (pressure && !pressure_blocked_.load(std::memory_order_relaxed) &&
+      !pressure_blocked_.exchange(true, std::memory_order_relaxed)) {
+    uint32_t shift = pressure_shift_.load(std::memory_order_relaxed);
+    if (shift < EpochAdvancePolicy::kMaxPressureShift) {
+      pressure_shift_.store(shift + 1, std::memory_order_relaxed);
+    }
+  }
+
+  Epoch current = current_epoch_.load(std::memory_order_seq_cst);
+  if (epoch >= current) {
+    if (!pressure) return false;
+    if (current_epoch_.compare_exchange_strong(current, current + 1,
+                                               std::memory_order_seq_cst)) {
+      OnEpochAdvanced(current);
+    }
+    return IsSafeToReclaim(epoch);
+  }
+
+  uint64_t last = last_refresh_ns_.load(std::memory_order_relaxed);
+  uint64_t now = NowNanoseconds();
+  if (now - last < (uint64_t)advance_policy_.min_refresh_interval.count() ||
+      !last_refresh_ns_.compare_exchange_strong(last, now,
+                                                std::memory_order_relaxed)) {
+    return false;
+  }
+  EPOCH_STAT(stats_.Add(kStatSafeEpochRefreshes));
+  CoalescedComputeSafeEpoch(current);
+  return IsSafeToReclaim(epoch);
+}
+
+/**
+ * Bumps tend to come in bursts (pushers cross the advance threshold within
+ * a few tickets of each other), and each used to scan the whole table. Now
+ * the first caller scans and later ones only record the epoch they wanted
+ * a scan for; before the scanner lets go it checks for such requests and
+ * scans once more for the newest. So a burst costs at most two scans, and
+ * every epoch a caller asked for is covered by a scan that started after
+ * the request. Callers that hand their request over return without
+ * waiting, possibly before the safe epoch has moved.
+ */
+void EpochManager::CoalescedComputeSafeEpoch(Epoch currentEpoch) {
+  for (;;) {
+    if (!scanning_.load(std::memory_order_relaxed) &&
+        !scanning_.exchange(true, std::memory_order_acquire)) {
+      Epoch target = scan_requested_.load(std::memory_order_relaxed);
+      if (target < currentEpoch) target = currentEpoch;
+      ComputeNewSafeToReclaimEpoch(target);
+      // Either a caller that asked for more while we scanned sees the flag
+      // clear and scans itself, or we see its request here; both sides are
+      // sequentially consistent, so they can't both miss.
+      scanning_.store(false);
+      currentEpoch = scan_requested_.load();
+      if (currentEpoch <= target) return;
+      continue;
+    }
+    Epoch requested = scan_requested_.load(std::memory_order_relaxed);
+    while (requested < currentEpoch &&
+           !scan_requested_.compare_exchange_weak(requested, currentEpoch)) {
+    }
+    if (scanning_.load()) {
+      EPOCH_STAT(stats_.Add(kStatCoalescedScans));
+      return;
+    }
+    // The scanner let go before it could have seen our request.
+  }
+}
+
+void EpochManager::GetStats(ReclamationStats* stats) {
+  *stats = ReclamationStats{};
+  stats->current_epoch = current_epoch_.load(std::memory_order_relaxed);
+  stats->safe_to_reclaim_epoch =
+      safe_to_reclaim_epoch_.load(std::memory_order_relaxed);
+  stats->epoch_gap = stats->current_epoch - stats->safe_to_reclaim_epoch;
+#ifdef EPOCH_STATS
+  stats->counters_enabled = true;
+  stats->epoch_bumps = stats_.Sum(kStatEpochBumps);
+  stats->safe_epoch_computations = stats_.Sum(kStatSafeEpochComputations);
+  stats->neutralize_signals = stats_.Sum(kStatNeutralizeSignals);
+  stats->safe_epoch_refreshes = stats_.Sum(kStatSafeEpochRefreshes);
+  stats->coalesced_scans = stats_.Sum(kStatCoalescedScans);
+  if (epoch_table_) epoch_table_->AddStats(stats);
+#endif
+}
+
+#ifdef EPOCH_STATS
+uint64_t EpochManager::GetEpochStartTime(Epoch epoch) {
+  Epoch current = current_epoch_.load(std::memory_order_relaxed);
+  // Slots of epochs this old may have been reused by newer ones already.
+  if (epoch > current || current - epoch >= kEpochTimes - 1) return 0;
+  return epoch_start_times_[epoch % kEpochTimes].load(
+      std::memory_order_relaxed);
+}
+#endif
+
+bool EpochManager::EnableNeutralization(Epoch max_lag, int signal) {
+  struct sigaction action = {};
+  action.sa_handler = &EpochManager::OnNeutralizeSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  if (sigaction(signal, &action, nullptr)) return false;
+  neutralize_signal_ = signal;
+  neutralize_lag_ = max_lag ? max_lag : 1;
+  return true;
+}
+
+void EpochManager::OnNeutralizeSignal(int signal) {
+  (void)signal;
+  // The signal may come from any manager the thread has a checkpoint in.
+  // Restart from the innermost checkpoint that took the protection of a
+  // manager that asked; everything nested inside it is abandoned with it,
+  // so all of those checkpoints must be armed. Otherwise (outside any
+  // checkpoint, or in a part the data structure marked unsafe to restart)
+  // carry on, the reclaimer will ask again.
+  RestartPoint* target = nullptr;
+  for (RestartPoint* point = tls_restart_point_; point; point = point->prev) {
+    if (!point->armed) {
+      // Withdraw every request so that later bumps signal again.
+      for (point = tls_restart_point_; point; point = point->prev) {
+        if (!point->outer_nesting) {
+          point->neutralize_requested->store(0, std::memory_order_relaxed);
+        }
+      }
+      return;
+    }
+    if (!point->outer_nesting &&
+        point->neutralize_requested->load(std::memory_order_relaxed)) {
+      target = point;
+      break;
+    }
+  }
+  if (!target) return;
+
+  // Roll every abandoned checkpoint back to the depth it was taken at,
+  // innermost first, and drop the protections they took. Unprotect hooks
+  // are not run here; they are not async-signal-safe and run on the next
+  // Unprotect() anyway.
+  for (RestartPoint* point = tls_restart_point_;; point = point->prev) {
+    *point->nesting = point->outer_nesting;
+    if (!point->outer_nesting) {
+      point->protected_epoch->store(0, std::memory_order_release);
+      point->restartable->store(0, std::memory_order_relaxed);
+    }
+    if (point == target) break;
+  }
+  target->neutralize_requested->store(0, std::memory_order_relaxed);
+  tls_restart_point_ = target->prev;
+  target->restarts = target->restarts + 1;
+  siglongjmp(target->env, 1);
 }
 
 // - private -
@@ -94,29 +368,33 @@ void EpochManager::BumpCurrentEpoch() {
  * might work as a reasonable heuristic for when this should be called.
  */
 void EpochManager::ComputeNewSafeToReclaimEpoch(Epoch currentEpoch) {
+  EPOCH_STAT(stats_.Add(kStatSafeEpochComputations));
   safe_to_reclaim_epoch_.store(
       epoch_table_->ComputeNewSafeToReclaimEpoch(currentEpoch),
       std::memory_order_release);
 }
-bool EpochManager::Protect() {
-  return epoch_table_->Protect(current_epoch_.load(std::memory_order_relaxed));
-}
-bool EpochManager::Unprotect() {
-  return epoch_table_->Unprotect(
-      current_epoch_.load(std::memory_order_relaxed));
-}
-Epoch EpochManager::GetCurrentEpoch() {
-  return current_epoch_.load(std::memory_order_seq_cst);
+
+bool EpochManager::RegisterUnprotectHook(UnprotectHook* hook) {
+  return epoch_table_->RegisterUnprotectHook(hook);
 }
-bool EpochManager::IsSafeToReclaim(Epoch epoch) {
-  return epoch <= safe_to_reclaim_epoch_.load(std::memory_order_relaxed);
+
+bool EpochManager::UnregisterUnprotectHook(UnprotectHook* hook) {
+  return MinEpochTable::UnregisterUnprotectHook(hook);
 }
-bool EpochManager::IsProtected() { return epoch_table_->IsProtected(); }
 
 // --- EpochManager::MinEpochTable ---
 
 /// Create an uninitialized table.
-EpochManager::MinEpochTable::MinEpochTable() : table_{nullptr}, size_{} {}
+EpochManager::MinEpochTable::MinEpochTable()
+    : nodes_{},
+      node_count_{},
+      emulate_nodes_{},
+      asymmetric_fences_{},
+      size_{},
+      id_{},
+      slot_{} {}
+
+EpochManager::MinEpochTable::~MinEpochTable() { Uninitialize(); }
 
 /**
  * Initialize an uninitialized table. This method must be used before
@@ -124,17 +402,24 @@ EpochManager::MinEpochTable::MinEpochTable() : table_{nullptr}, size_{} {}
  * initialized instance has no effect.
  *
  * \param size The initial number of distinct threads to support calling
- *       Protect()/Unprotect(). This must be a power of two. If the table runs
- *       out of space to track threads, then calls may stall. Internally, the
- *       table may allocate additional tables to solve this, or it may reclaim
- *       entries in the table after a long idle periods of by some threads.
- *       If this number is too large it may slow down threads performing
- *       space reclamation, since this table must be scanned occasionally to
- *       make progress.
- * TODO(stutsman) Table growing and entry reclamation are not yet implemented.
- * Currently, the manager supports precisely size distinct threads over the
- * lifetime of the manager until it begins permanently spinning in all calls to
- * Protect().
+ *       Protect()/Unprotect(). This must be a power of two. Entries are
+ *       returned to the table when their threads exit; if the table still
+ *       runs out of space it first reclaims entries of threads that died
+ *       without releasing them and then grows by another segment of \a size
+ *       entries, up to kMaxSegments. Only when that limit is hit does
+ *       Protect() fail. Scans only cover entries that have been in use, so
+ *       a large \a size costs memory but not reclamation time. Each NUMA
+ *       node gets its own sub-table of this size.
+ * \param nodes Number of per-node sub-tables to keep; 0 means one per NUMA
+ *       node in the system. Other values are meant for exercising the
+ *       multi-node paths on smaller machines; threads are then assigned to
+ *       sub-tables by CPU.
+ * \param asymmetric_fences Use membarrier() in the scan instead of a full
+ *       fence in Protect(), if the kernel supports it.
+ *
+ * Up to kMaxTables tables may be initialized at once; each gets its own
+ * slot in every thread's entry cache, so a thread protected in several
+ * EpochManagers holds an independent entry in each.
  *
  * \retval S_OK Initialization was successful and instance is ready for use.
  * \retval S_FALSE Instance was already initialized; instance is ready for use.
@@ -144,17 +429,48 @@ EpochManager::MinEpochTable::MinEpochTable() : table_{nullptr}, size_{} {}
  * \retval HRESULT_FROM_WIN32(TLS_OUT_OF_INDEXES) Initialization failed because
  *       TlsAlloc() failed; the table was safely left in an uninitialized state.
  */
-bool EpochManager::MinEpochTable::Initialize(uint64_t size) {
-  if (table_) return true;
+bool EpochManager::MinEpochTable::Initialize(uint64_t size, uint32_t nodes,
+                                             bool asymmetric_fences) {
+  if (nodes_[0]) return true;
 
   if (!IS_POWER_OF_TWO(size)) return false;
 
-  Entry* new_table = new Entry[size];
-  if (!new_table) return false;
+  {
+    std::unique_lock<std::mutex> lock(live_tables_mutex_);
+    uint32_t slot = 0;
+    while (slot < kMaxTables && live_tables_[slot]) ++slot;
+    if (slot == kMaxTables) return false;
+    id_ = next_table_id_.fetch_add(1, std::memory_order_relaxed);
+    slot_ = slot;
+    // Claim the slot now; threads only look it up once nodes_ is set.
+    live_tables_[slot_] = id_;
+  }
 
-  table_ = new_table;
+  uint32_t detected = DetectNodeCount();
+  node_count_ = nodes ? nodes : detected;
+  if (node_count_ > kMaxNodes) node_count_ = kMaxNodes;
+  emulate_nodes_ = node_count_ != detected;
+  asymmetric_fences_ = asymmetric_fences && RegisterMembarrier();
   size_ = size;
 
+  for (uint32_t n = 0; n < node_count_; ++n) {
+    void* mem = AllocateOnNode(sizeof(NodeTable), n);
+    void* occupancy = mem ? AllocateOnNode(OccupancyBytes(), n) : nullptr;
+    Entry* segment = occupancy ? NewSegment(n, 0) : nullptr;
+    if (!segment) {
+      if (occupancy) munmap(occupancy, OccupancyBytes());
+      if (mem) munmap(mem, sizeof(NodeTable));
+      Uninitialize();
+      return false;
+    }
+    NodeTable* node = new (mem) NodeTable{};
+    node->node_id = n;
+    // Fresh anonymous pages are zeroed, i.e. all entries unoccupied.
+    node->occupancy = static_cast<std::atomic<uint64_t>*>(occupancy);
+    node->segments[0].store(segment, std::memory_order_release);
+    node->capacity.store(size, std::memory_order_release);
+    nodes_[n] = node;
+  }
   return true;
 }
 
@@ -176,80 +492,37 @@ bool EpochManager::MinEpochTable::Initialize(uint64_t size) {
  * \retval S_FALSE Success; no effect, since table was already uninitialized.
  */
 bool EpochManager::MinEpochTable::Uninitialize() {
-  if (!table_) return true;
-
-  size_ = 0;
-  delete[] table_;
-  table_ = nullptr;
-
-  return true;
-}
+  if (!id_) return true;
 
-/**
- * Enter the thread into the protected code region, which guarantees
- * pointer stability for records in client data structures. After this
- * call, accesses to protected data structure items are guaranteed to be
- * safe, even if the item is concurrently removed from the structure.
- *
- * Behavior is undefined if Protect() is called from an already
- * protected thread. Upon creation, threads are unprotected.
- *
- * \param currentEpoch A sequentially consistent snapshot of the current
- *      global epoch. It is okay that this may be stale by the time it
- *      actually gets entered into the table.
- * \return S_OK indicates thread may now enter the protected region. Any
- *      other return indicates a fatal problem accessing the thread local
- *      storage; the thread may not enter the protected region. Most likely
- *      the library has entered some non-serviceable state.
- */
-bool EpochManager::MinEpochTable::Protect(Epoch current_epoch) {
-  Entry* entry = nullptr;
-  if (!GetEntryForThread(&entry)) {
-    return false;
+  {
+    // From here on exiting threads leave their entries alone, and the slot
+    // may be handed to a new table; stale caches fail the id check.
+    std::unique_lock<std::mutex> lock(live_tables_mutex_);
+    live_tables_[slot_] = 0;
+  }
+  id_ = 0;
+  ThreadEntry& tls = tls_entries_[slot_];
+  if (tls.table == this) {
+    Thread::UnregisterTls(&tls.table_id);
+    tls.table_id = 0;
+    tls.entry = nullptr;
+    tls.table = nullptr;
   }
 
-  entry->last_unprotected_epoch = 0;
-#if 1
-  entry->protected_epoch.store(current_epoch, std::memory_order_release);
-  // TODO: For this to really make sense according to the spec we
-  // need a (relaxed) load on entry->protected_epoch. What we want to
-  // ensure is that loads "above" this point in this code don't leak down
-  // and access data structures before it is safe.
-  // Consistent with http://preshing.com/20130922/acquire-and-release-fences/
-  // but less clear whether it is consistent with stdc++.
-  std::atomic_thread_fence(std::memory_order_acquire);
-#else
-  entry->m_protectedEpoch.exchange(currentEpoch, std::memory_order_acq_rel);
-#endif
-  return true;
-}
-
-/**
- * Exit the thread from the protected code region. The thread must
- * promise not to access pointers to elements in the protected data
- * structures beyond this call.
- *
- * Behavior is undefined if Unprotect() is called from an already
- * unprotected thread.
- *
- * \param currentEpoch A any rough snapshot of the current global epoch, so
- *      long as it is greater than or equal to the value used on the thread's
- *      corresponding call to Protect().
- * \return S_OK indicates thread successfully exited protected region. Any
- *      other return indicates a fatal problem accessing the thread local
- *      storage; the thread may not have successfully exited the protected
- *      region. Most likely the library has entered some non-serviceable
- *      state.
- */
-bool EpochManager::MinEpochTable::Unprotect(Epoch currentEpoch) {
-  Entry* entry = nullptr;
-  if (!GetEntryForThread(&entry)) {
-    return false;
+  for (uint32_t n = 0; n < kMaxNodes; ++n) {
+    NodeTable* node = nodes_[n];
+    if (!node) continue;
+    for (uint64_t i = 0; i < kMaxSegments; ++i) {
+      Entry* segment = node->segments[i].load(std::memory_order_relaxed);
+      if (segment) munmap(segment, sizeof(Entry) * size_);
+    }
+    munmap(node->occupancy, OccupancyBytes());
+    munmap(node, sizeof(NodeTable));
+    nodes_[n] = nullptr;
   }
+  node_count_ = 0;
+  size_ = 0;
 
-  entry->last_unprotected_epoch = currentEpoch;
-  std::atomic_thread_fence(std::memory_order_release);
-  entry->protected_epoch.store(0, std::memory_order_relaxed);
   return true;
 }
 
@@ -272,55 +545,219 @@ bool EpochManager::MinEpochTable::Unprotect(Epoch currentEpoch) {
  */
 Epoch EpochManager::MinEpochTable::ComputeNewSafeToReclaimEpoch(
     Epoch current_epoch) {
+  // Readers in asymmetric mode only issue a compiler barrier after
+  // publishing their epoch; make those stores visible before reading them.
+  if (asymmetric_fences_) {
+    syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+  }
+
+  // Scan the local node's entries, but trust other nodes' summaries unless
+  // they have gone stale; that keeps most of the bump socket-local.
+  uint32_t home = CurrentNode();
   Epoch oldest_call = current_epoch;
-  for (uint64_t i = 0; i < size_; ++i) {
-    Entry& entry = table_[i];
-    // If any other thread has flushed a protected epoch to the cache
-    // hierarchy we're guaranteed to see it even with relaxed access.
-    Epoch entryEpoch = entry.protected_epoch.load(std::memory_order_acquire);
-    if (entryEpoch != 0 && entryEpoch < oldest_call) {
-      oldest_call = entryEpoch;
+  for (uint32_t n = 0; n < node_count_; ++n) {
+    NodeTable& node = *nodes_[n];
+    Epoch summary = node.summary_epoch.load(std::memory_order_acquire);
+    Epoch node_oldest;
+    if (n == home || summary == 0 ||
+        summary + kNodeSummaryMaxAge < current_epoch) {
+      node_oldest = ScanNode(node, current_epoch);
+    } else {
+      node_oldest = node.min_epoch.load(std::memory_order_relaxed);
     }
+    if (node_oldest < oldest_call) oldest_call = node_oldest;
   }
   // The latest safe epoch is the one just before the earlier unsafe one.
   return oldest_call - 1;
 }
 
-// - private -
+namespace {
 
-/**
- * Get a pointer to the thread-specific state needed for a thread to
- * Protect()/Unprotect(). If no thread-specific Entry has been allocated
- * yet, then one it transparently allocated and its address is stashed
- * in the thread's local storage.
- *
- * \param[out] entry Points to an address that is populated with
- *      a pointer to the thread's Entry upon return. It is illegal to
- *      pass nullptr.
- * \return S_OK if the thread's entry was discovered or allocated; in such
- *      a successful call \a entry points to a pointer to the Entry.
- *      Any other return value means there was a problem accessing or
- *      setting values in the thread's local storage. The value pointed
- *      to by entry remains unchanged, but the library may have entered
- *      a non-serviceable state.
- */
-bool EpochManager::MinEpochTable::GetEntryForThread(Entry** entry) {
-  thread_local Entry* tls = nullptr;
-  if (tls) {
-    *entry = tls;
-    return true;
+/// Returns the smallest non-zero epoch among *epochs[0, count), or \a floor
+/// if that is smaller. Gathers several entries' protected epochs per
+/// instruction where the target supports it; each of them is still a
+/// separate cacheline, so this mostly helps by keeping several misses in
+/// flight at once. Protected epochs stay far below 2^63, so the AVX2 path
+/// may compare them as signed values.
+Epoch MinProtectedEpoch(const std::atomic<Epoch>* const* epochs, size_t count,
+                        Epoch floor) {
+  size_t i = 0;
+#if defined(__AVX512F__)
+  // The masked gather and the final reduction through memory avoid the
+  // intrinsics that start from an undefined register, which GCC flags as
+  // maybe-uninitialized.
+  __m512i oldest = _mm512_set1_epi64(floor);
+  const __m512i zero = _mm512_setzero_si512();
+  for (; i + 8 <= count; i += 8) {
+    __m512i addresses = _mm512_loadu_si512((const void*)(epochs + i));
+    __m512i values =
+        _mm512_mask_i64gather_epi64(zero, 0xff, addresses, nullptr, 1);
+    // Unprotected entries hold 0 and must not take part.
+    __mmask8 protect = _mm512_test_epi64_mask(values, values);
+    oldest = _mm512_mask_min_epu64(oldest, protect, oldest, values);
   }
+  alignas(64) Epoch lanes[8];
+  _mm512_store_si512((void*)lanes, oldest);
+  for (Epoch lane : lanes) {
+    if (lane < floor) floor = lane;
+  }
+#elif defined(__AVX2__)
+  __m256i oldest = _mm256_set1_epi64x(floor);
+  const __m256i zero = _mm256_setzero_si256();
+  for (; i + 4 <= count; i += 4) {
+    __m256i addresses = _mm256_loadu_si256((const __m256i*)(epochs + i));
+    __m256i values = _mm256_i64gather_epi64(nullptr, addresses, 1);
+    // Unprotected entries hold 0 and must not take part.
+    __m256i unprotected = _mm256_cmpeq_epi64(values, zero);
+    values = _mm256_blendv_epi8(values, oldest, unprotected);
+    __m256i older = _mm256_cmpgt_epi64(oldest, values);
+    oldest = _mm256_blendv_epi8(oldest, values, older);
+  }
+  alignas(32) Epoch lanes[4];
+  _mm256_store_si256((__m256i*)lanes, oldest);
+  for (Epoch lane : lanes) {
+    if (lane < floor) floor = lane;
+  }
+#endif
+  for (; i < count; ++i) {
+    // If any other thread has flushed a protected epoch to the cache
+    // hierarchy we're guaranteed to see it even with relaxed access.
+    Epoch entryEpoch = epochs[i]->load(std::memory_order_acquire);
+    if (entryEpoch != 0 && entryEpoch < floor) floor = entryEpoch;
+  }
+  return floor;
+}
+
+}  // namespace
+
+Epoch EpochManager::MinEpochTable::ScanNode(NodeTable& node,
+                                            Epoch current_epoch) {
+  Epoch oldest_call = current_epoch;
+  uint64_t live = node.high_water.load(std::memory_order_acquire);
+  EPOCH_STAT(uint64_t scanned = 0);
+  unsigned segment_shift = __builtin_ctzll(size_);
+
+  // Only look at entries the occupancy bitmap says are owned; free entries'
+  // cachelines are never touched.
+  const std::atomic<Epoch>* epochs[64];
+  for (uint64_t word = 0; word * 64 < live; ++word) {
+    uint64_t bits = node.occupancy[word].load(std::memory_order_acquire);
+    size_t count = 0;
+    while (bits) {
+      uint64_t index = word * 64 + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      Entry* segment = node.segments[index >> segment_shift].load(
+          std::memory_order_acquire);
+      epochs[count++] = &segment[index & (size_ - 1)].protected_epoch;
+    }
+    oldest_call = MinProtectedEpoch(epochs, count, oldest_call);
+    EPOCH_STAT(scanned += count);
+  }
+  node.min_epoch.store(oldest_call, std::memory_order_relaxed);
+  node.summary_epoch.store(current_epoch, std::memory_order_release);
+  EPOCH_STAT(stats_.Add(kStatEntriesScanned, scanned));
+  return oldest_call;
+}
+
+void EpochManager::MinEpochTable::AddStats(ReclamationStats* stats) {
+#ifdef EPOCH_STATS
+  stats->protects += stats_.Sum(kStatProtects);
+  stats->entries_reserved += stats_.Sum(kStatEntriesReserved);
+  stats->entries_scanned += stats_.Sum(kStatEntriesScanned);
+#else
+  (void)stats;
+#endif
+}
+
+// - private -
+
+thread_local EpochManager::MinEpochTable::ThreadEntryReleaser
+    EpochManager::MinEpochTable::tls_entry_releaser_;
+
+/// Slow path of GetEntryForThread(): reserve an entry for the calling thread
+/// and cache it in the thread's slot for this table.
+bool EpochManager::MinEpochTable::CacheEntryForThread(Entry** entry) {
+  ThreadEntry& tls = tls_entries_[slot_];
 
   // No entry index was found in TLS, so we need to reserve a new entry
   // and record its index in TLS
   Entry* reserved = ReserveEntryForThread();
-  tls = *entry = reserved;
+  if (!reserved) return false;
+  EPOCH_STAT(stats_.Add(kStatEntriesReserved));
+  // A table that previously owned this slot is gone (or it would still own
+  // it), so whatever is cached here can simply be overwritten.
+  if (tls.table) Thread::UnregisterTls(&tls.table_id);
+  tls.entry = *entry = reserved;
+  tls.table = this;
+  tls.table_id = id_;
 
-  Thread::RegisterTls((uint64_t*)&tls, (uint64_t) nullptr);
+  // Touch the releaser so its destructor runs when this thread exits.
+  (void)&tls_entry_releaser_;
+  Thread::RegisterTls(&tls.table_id, 0);
 
   return true;
 }
 
+bool EpochManager::MinEpochTable::RegisterUnprotectHook(UnprotectHook* hook) {
+  Entry* entry = nullptr;
+  if (!GetEntryForThread(&entry)) return false;
+  hook->next = entry->unprotect_hooks;
+  hook->table_id = id_;
+  hook->table_slot = slot_;
+  entry->unprotect_hooks = hook;
+  return true;
+}
+
+/**
+ * Unlink \a hook from the calling thread's entry in the table it was
+ * registered with. Goes by the ids recorded in the hook rather than through
+ * the table, so callers need not know whether the table still exists: if it
+ * was uninitialized its entries, and the hook lists in them, are gone, and
+ * if the thread's entry was released its hooks were dropped with it.
+ */
+bool EpochManager::MinEpochTable::UnregisterUnprotectHook(UnprotectHook* hook) {
+  if (!hook->table_id) return false;
+  ThreadEntry& tls = tls_entries_[hook->table_slot];
+  Entry* entry = nullptr;
+  {
+    // Keeps the table from being uninitialized while we walk its entry.
+    std::unique_lock<std::mutex> lock(live_tables_mutex_);
+    if (live_tables_[hook->table_slot] == hook->table_id &&
+        tls.table_id == hook->table_id) {
+      entry = tls.entry;
+    }
+    hook->table_id = 0;
+    if (!entry) return false;
+    for (UnprotectHook** link = &entry->unprotect_hooks; *link;
+         link = &(*link)->next) {
+      if (*link == hook) {
+        *link = hook->next;
+        hook->next = nullptr;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+EpochManager::MinEpochTable::ThreadEntryReleaser::~ThreadEntryReleaser() {
+  for (uint32_t slot = 0; slot < kMaxTables; ++slot) {
+    ThreadEntry& tls = tls_entries_[slot];
+    if (!tls.table) continue;
+    if (tls.table_id) {
+      std::unique_lock<std::mutex> lock(live_tables_mutex_);
+      if (live_tables_[slot] == tls.table_id) {
+        DropUnprotectHooks(tls.entry);
+        tls.table->ReleaseEntry(tls.entry);
+      }
+    }
+    Thread::UnregisterTls(&tls.table_id);
+    tls.table_id = 0;
+    tls.entry = nullptr;
+    tls.table = nullptr;
+  }
+}
+
 uint32_t Murmur3(uint32_t h) {
   h ^= h >> 16;
   h *= 0x85ebca6b;
@@ -337,8 +774,9 @@ uint32_t Murmur3(uint32_t h) {
 EpochManager::MinEpochTable::Entry*
 EpochManager::MinEpochTable::ReserveEntryForThread() {
   uint64_t current_thread_id = pthread_self();
-  uint64_t startIndex = Murmur3_64(current_thread_id);
-  return ReserveEntry(startIndex, current_thread_id);
+  // First-fit from the start of the table keeps live entries packed below
+  // #high_water_, which bounds the work done by every table scan.
+  return ReserveEntry(0, current_thread_id);
 }
 
 /**
@@ -346,78 +784,308 @@ EpochManager::MinEpochTable::ReserveEntryForThread() {
  * split out for easy unit testing. This method relies on the fact that no
  * thread will ever have ID on Windows 0.
  * http://msdn.microsoft.com/en-us/library/windows/desktop/ms686746(v=vs.85).aspx
+ *
+ * Never blocks: if every entry is taken it tries to reclaim entries of
+ * exited threads, then grows the table. Returns nullptr only once the table
+ * is at kMaxSegments and all entries belong to live threads.
  */
 EpochManager::MinEpochTable::Entry* EpochManager::MinEpochTable::ReserveEntry(
     uint64_t start_index, uint64_t thread_id) {
+  // Prefer an entry in the sub-table of the node we are running on; only
+  // spill over to remote nodes once ours cannot grow any further.
+  uint32_t home = CurrentNode();
+  for (uint32_t i = 0; i < node_count_; ++i) {
+    NodeTable& node = *nodes_[(home + i) % node_count_];
+    Entry* entry = ReserveEntryOnNode(node, start_index, thread_id);
+    if (entry) return entry;
+  }
+  return nullptr;
+}
+
+EpochManager::MinEpochTable::Entry*
+EpochManager::MinEpochTable::ReserveEntryOnNode(NodeTable& node,
+                                                uint64_t start_index,
+                                                uint64_t thread_id) {
   for (;;) {
     // Reserve an entry in the table.
-    for (uint64_t i = 0; i < size_; ++i) {
-      uint64_t indexToTest = (start_index + i) & (size_ - 1);
-      Entry& entry = table_[indexToTest];
-      if (entry.thread_id == 0) {
+    uint64_t capacity = node.capacity.load(std::memory_order_acquire);
+    for (uint64_t i = 0; i < capacity; ++i) {
+      uint64_t indexToTest = (start_index + i) % capacity;
+      Entry& entry = EntryAt(node, indexToTest);
+      if (entry.thread_id.load(std::memory_order_relaxed) == 0) {
         uint64_t expected = 0;
         // Atomically grab a slot. No memory barriers needed.
         // Once the threadId is in place the slot is locked.
         bool success = entry.thread_id.compare_exchange_strong(
             expected, thread_id, std::memory_order_relaxed);
         if (success) {
-          return &table_[indexToTest];
+          entry.os_thread_id.store(syscall(SYS_gettid),
+                                   std::memory_order_relaxed);
+          node.occupancy[indexToTest / 64].fetch_or(1ull << (indexToTest % 64));
+          // Publish the entry to scanners before it can ever be protected.
+          uint64_t mark = node.high_water.load(std::memory_order_relaxed);
+          while (mark <= indexToTest &&
+                 !node.high_water.compare_exchange_weak(mark,
+                                                        indexToTest + 1)) {
+          }
+          return &entry;
         }
         // Ignore the CAS failure since the entry must be populated,
         // just move on to the next entry.
       }
     }
-    ReclaimOldEntries();
+    if (ReclaimOldEntries()) continue;
+    if (!Grow(node, capacity)) return nullptr;
   }
 }
 
-bool EpochManager::MinEpochTable::IsProtected() {
-  Entry* entry = nullptr;
-  auto s = GetEntryForThread(&entry);
-  // It's myself checking my own protected_epoch, safe to use relaxed
-  return entry->protected_epoch.load(std::memory_order_relaxed) != 0;
+/**
+ * Give the calling thread's entry back to the table so another thread can
+ * use it. The thread must be unprotected; it transparently reserves a new
+ * entry on its next Protect(). Called automatically when a thread exits.
+ */
+void EpochManager::MinEpochTable::ReleaseEntryForThread() {
+  ThreadEntry& tls = tls_entries_[slot_];
+  if (tls.table_id != id_ || !id_) return;
+  // Let the hooks publish what they hold (e.g. staged retires) one last
+  // time, then leave them to be registered again with the next entry.
+  RunUnprotectHooks(tls.entry);
+  DropUnprotectHooks(tls.entry);
+  ReleaseEntry(tls.entry);
+  tls.table_id = 0;
+  tls.entry = nullptr;
+}
+
+/**
+ * Free entries whose owning thread exited without releasing them. Candidates
+ * are entries whose last reported epoch (last_unprotected_epoch, or
+ * protected_epoch for threads that died while protected) trails the latest
+ * epoch reported by any entry by kStaleEntryEpochs; those are then checked
+ * for a live kernel thread. Live threads are never preempted, since they may
+ * still use their cached entry pointer.
+ *
+ * \return The number of entries made available.
+ */
+uint64_t EpochManager::MinEpochTable::ReclaimOldEntries() {
+  // The table has no notion of the current epoch; the most recent epoch any
+  // thread reported is a close enough stand-in.
+  Epoch latest = 0;
+  for (uint32_t n = 0; n < node_count_; ++n) {
+    NodeTable& node = *nodes_[n];
+    uint64_t live = node.high_water.load(std::memory_order_acquire);
+    for (uint64_t i = 0; i < live; ++i) {
+      Entry& entry = EntryAt(node, i);
+      Epoch seen = entry.protected_epoch.load(std::memory_order_relaxed);
+      if (seen > latest) latest = seen;
+      if (entry.last_unprotected_epoch > latest)
+        latest = entry.last_unprotected_epoch;
+    }
+  }
+
+  static const uint64_t kReclaimingThreadId = ~0llu;
+  pid_t pid = getpid();
+  uint64_t reclaimed = 0;
+  for (uint32_t n = 0; n < node_count_; ++n) {
+    NodeTable& node = *nodes_[n];
+    uint64_t live = node.high_water.load(std::memory_order_acquire);
+    for (uint64_t i = 0; i < live; ++i) {
+      Entry& entry = EntryAt(node, i);
+      uint64_t owner = entry.thread_id.load(std::memory_order_relaxed);
+      if (owner == 0 || owner == kReclaimingThreadId) continue;
+
+      Epoch seen = entry.protected_epoch.load(std::memory_order_relaxed);
+      if (!seen) seen = entry.last_unprotected_epoch;
+      if (seen + kStaleEntryEpochs > latest) continue;
+
+      // Threads normally release their entries on exit, but an entry
+      // reserved by a thread_local destructor that runs after the thread's
+      // ThreadEntryReleaser (e.g. one flushing a retire buffer under a
+      // guard) outlives its thread. Signal 0 only asks whether the thread
+      // is alive. A tid reused by a newer thread of this process merely
+      // makes a dead owner look alive and its entry stay reserved; a live
+      // owner's tid can never look dead, so its cached entry is never
+      // taken away.
+      int32_t tid = entry.os_thread_id.load(std::memory_order_relaxed);
+      if (!tid) continue;
+      if (syscall(SYS_tgkill, pid, tid, 0) == 0 || errno != ESRCH) continue;
+
+      if (entry.thread_id.compare_exchange_strong(owner,
+                                                  kReclaimingThreadId)) {
+        ReleaseEntry(&entry);
+        ++reclaimed;
+      }
+    }
+  }
+  return reclaimed;
+}
+
+EpochManager::MinEpochTable::Entry& EpochManager::MinEpochTable::EntryAt(
+    NodeTable& node, uint64_t index) {
+  Entry* segment = node.segments[index / size_].load(std::memory_order_acquire);
+  return segment[index & (size_ - 1)];
 }
 
-void EpochManager::MinEpochTable::ReleaseEntryForThread() {}
+bool EpochManager::MinEpochTable::Grow(NodeTable& node, uint64_t capacity) {
+  uint64_t segment = capacity / size_;
+  if (segment >= kMaxSegments) return false;
 
-void EpochManager::MinEpochTable::ReclaimOldEntries() {}
+  if (!node.segments[segment].load(std::memory_order_acquire)) {
+    Entry* fresh = NewSegment(node.node_id, capacity);
+    if (!fresh) return false;
+    Entry* expected = nullptr;
+    if (!node.segments[segment].compare_exchange_strong(expected, fresh)) {
+      // Someone else grew the table first; use theirs.
+      munmap(fresh, sizeof(Entry) * size_);
+    }
+  }
+  // Readers only ever index below the capacity, so the segment pointer must
+  // be visible before the capacity covers it.
+  node.capacity.compare_exchange_strong(capacity, capacity + size_);
+  return true;
+}
 
-EpochManager::MinEpochTable::Entry::Entry()
-    : protected_epoch{0}, last_unprotected_epoch{0}, thread_id{0} {}
-void* EpochManager::MinEpochTable::Entry::operator new[](uint64_t count) {
-#ifdef WIN32
-  return _aligned_malloc(count, CACHELINE_SIZE);
-#else
-  void* mem = nullptr;
-  int n = posix_memalign(&mem, CACHELINE_SIZE, count);
+uint32_t EpochManager::MinEpochTable::CurrentNode() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (node_count_ == 1 || getcpu(&cpu, &node) != 0) return 0;
+  return (emulate_nodes_ ? cpu : node) % node_count_;
+}
+
+EpochManager::MinEpochTable::Entry* EpochManager::MinEpochTable::NewSegment(
+    uint32_t node, uint64_t first_index) {
+  void* mem = AllocateOnNode(sizeof(Entry) * size_, node);
+  if (!mem) return nullptr;
+  Entry* segment = static_cast<Entry*>(mem);
+  for (uint64_t i = 0; i < size_; ++i) {
+    ::new (&segment[i]) Entry();
+    segment[i].node_id = node;
+    segment[i].index = first_index + i;
+  }
+  return segment;
+}
+
+uint64_t EpochManager::MinEpochTable::OccupancyBytes() {
+  return (kMaxSegments * size_ + 63) / 64 * sizeof(uint64_t);
+}
+
+void* EpochManager::MinEpochTable::AllocateOnNode(uint64_t bytes,
+                                                  uint32_t node) {
+  // mmap rather than malloc so the pages are fresh and not shared with
+  // memory another node already touched; page alignment also gives every
+  // Entry its own cacheline.
+  void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return nullptr;
+  if (node_count_ > 1 && !emulate_nodes_) {
+    // Placement is best effort: if the policy cannot be applied the pages
+    // simply land wherever they are first touched.
+    unsigned long nodemask = 1ul << node;
+    syscall(SYS_mbind, mem, bytes, MPOL_PREFERRED, &nodemask,
+            sizeof(nodemask) * 8 + 1, 0);
+  }
   return mem;
-#endif
 }
-void EpochManager::MinEpochTable::Entry::operator delete[](void* p) {
-#ifdef WIN32
-  /// _aligned_malloc-specific delete.
-  return _aligned_free(p);
-#else
-  free(p);
-#endif
+
+uint32_t EpochManager::MinEpochTable::DetectNodeCount() {
+  // The file holds a list such as "0" or "0-1" or "0,2-3"; we want the
+  // highest node id plus one.
+  FILE* f = fopen("/sys/devices/system/node/possible", "r");
+  if (!f) return 1;
+  uint32_t highest = 0;
+  unsigned value = 0;
+  while (fscanf(f, "%u", &value) == 1) {
+    if (value > highest) highest = value;
+    if (fgetc(f) == EOF) break;
+  }
+  fclose(f);
+  return highest + 1;
 }
-EpochGuard::EpochGuard(EpochManager* epoch_manager)
-    : epoch_manager_{epoch_manager}, unprotect_at_exit_(true) {
-  epoch_manager_->Protect();
+
+/**
+ * Send \a signal to every thread whose published epoch is older than
+ * \a threshold and was published by a RestartPoint, except the calling one;
+ * used to neutralize threads that hold reclamation back (see
+ * EpochManager::EnableNeutralization()). A thread is signalled once per
+ * request: until its handler withdraws the request, or its next RestartPoint
+ * clears it, it is skipped. Other threads may be blocked in calls SA_RESTART
+ * does not restart, so they are never interrupted.
+ *
+ * \return The number of threads signalled.
+ */
+uint64_t EpochManager::MinEpochTable::SignalLaggingThreads(Epoch threshold,
+                                                           int signal) {
+  pid_t self = syscall(SYS_gettid);
+  pid_t pid = getpid();
+  uint64_t signalled = 0;
+  for (uint32_t n = 0; n < node_count_; ++n) {
+    NodeTable& node = *nodes_[n];
+    uint64_t live = node.high_water.load(std::memory_order_acquire);
+    for (uint64_t i = 0; i < live; ++i) {
+      Entry& entry = EntryAt(node, i);
+      Epoch epoch = entry.protected_epoch.load(std::memory_order_acquire);
+      if (epoch == 0 || epoch >= threshold) continue;
+      if (!entry.restartable.load(std::memory_order_relaxed)) continue;
+      pid_t tid = entry.os_thread_id.load(std::memory_order_relaxed);
+      if (tid <= 0 || tid == self) continue;
+      // The handler looks for this before restarting anything.
+      if (entry.neutralize_requested.exchange(1, std::memory_order_relaxed)) {
+        continue;
+      }
+      if (syscall(SYS_tgkill, pid, tid, signal) == 0) ++signalled;
+    }
+  }
+  return signalled;
 }
-EpochGuard::EpochGuard(EpochManager* epoch_manager, bool protect)
-    : epoch_manager_{epoch_manager}, unprotect_at_exit_(protect) {
-  if (protect) {
-    epoch_manager_->Protect();
+
+bool EpochManager::MinEpochTable::RegisterMembarrier() {
+  long supported = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+  if (supported < 0 || !(supported & MEMBARRIER_CMD_PRIVATE_EXPEDITED)) {
+    return false;
   }
+  // Registration is per process and idempotent.
+  return syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0,
+                 0) == 0;
 }
-EpochGuard::~EpochGuard() {
-  if (unprotect_at_exit_ && epoch_manager_) {
-    epoch_manager_->Unprotect();
+
+/**
+ * Unlink every hook of \a entry and mark it unregistered (see
+ * UnprotectHook::table_id), so that its owner registers it again when it
+ * needs it. Only the entry's owning thread may call this: hooks of a thread
+ * that died may be gone, so ReclaimOldEntries() just drops the list.
+ */
+void EpochManager::MinEpochTable::DropUnprotectHooks(Entry* entry) {
+  for (UnprotectHook* hook = entry->unprotect_hooks; hook;) {
+    UnprotectHook* next = hook->next;
+    hook->next = nullptr;
+    hook->table_id = 0;
+    hook = next;
   }
+  entry->unprotect_hooks = nullptr;
 }
-EpochManager* EpochGuard::Release() {
-  EpochManager* ret = epoch_manager_;
-  epoch_manager_ = nullptr;
-  return ret;
+
+void EpochManager::MinEpochTable::ReleaseEntry(Entry* entry) {
+  entry->protected_epoch.store(0, std::memory_order_relaxed);
+  entry->last_unprotected_epoch = 0;
+  entry->unprotect_hooks = nullptr;
+  entry->nesting = 0;
+  entry->neutralize_requested.store(0, std::memory_order_relaxed);
+  entry->restartable.store(0, std::memory_order_relaxed);
+  entry->online = 0;
+  entry->os_thread_id.store(0, std::memory_order_relaxed);
+  nodes_[entry->node_id]->occupancy[entry->index / 64].fetch_and(
+      ~(1ull << (entry->index % 64)));
+  entry->thread_id.store(0, std::memory_order_release);
 }
+
+EpochManager::MinEpochTable::Entry::Entry()
+    : protected_epoch{0},
+      last_unprotected_epoch{0},
+      thread_id{0},
+      unprotect_hooks{nullptr},
+      os_thread_id{0},
+      node_id{0},
+      index{0},
+      nesting{0},
+      neutralize_requested{0},
+      restartable{0},
+      online{0} {}
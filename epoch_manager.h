@@ -6,10 +6,14 @@
 
 
 #include <atomic>
+#include <chrono>
+#include <csetjmp>
+#include <csignal>
 #include <cstdint>
 #include <list>
 #include <mutex>
 #include <thread>
+#include "reclamation_stats.h"
 #include "tls_thread.h"
 #include "utils.h"
 
@@ -22,6 +26,95 @@
 /// and EpochManager::IsSafeToReclaim()).
 typedef uint64_t Epoch;
 
+/// Decides when threads retiring items into a garbage list advance the
+/// global epoch; see EpochManager::SetAdvancePolicy(). Garbage lists consult
+/// it once per ring slot they claim (the slot's ticket numbers the items
+/// the list has taken in) unless a background reclaimer does the bumping.
+///
+/// Whatever the policy, a list bumps at least twice per lap of its ring.
+/// Items are only recycled once they are older than every protected
+/// thread, so a pusher that wraps around to items retired in the epoch its
+/// own guard entered could never make progress.
+struct EpochAdvancePolicy {
+  enum Kind {
+    /// Bump every time 1/2^#ring_shift of the list's ring has been filled.
+    /// The default, with a quarter of the ring.
+    kRingFraction,
+
+    /// Bump once the current epoch is older than #interval, whatever the
+    /// retire rate; the clock is read every kTimeCheckTickets items.
+    kTime,
+
+    /// Bump every #retire_count items retired into a list.
+    kRetireCount,
+
+    /// Adapt the ring fraction to how often retiring threads run into
+    /// items that are not safe yet: every epoch in which one did doubles
+    /// the bump rate, every epoch in which none did halves it, between
+    /// 2^kMinPressureShift and 2^kMaxPressureShift bumps per lap. A pusher
+    /// stuck on an item of the current epoch also bumps right away.
+    kPressure,
+
+    /// Ask #callback.
+    kCustom,
+  };
+
+  /// kCustom: return true to have the retiring thread bump the epoch.
+  typedef bool (*Callback)(void* context, int64_t ticket, uint64_t ring_size);
+
+  /// How many items kTime lets go by between clock reads.
+  static const uint64_t kTimeCheckTickets = 64;
+
+  /// Bounds of kPressure's ring fraction shift.
+  static const uint32_t kMinPressureShift = 1;
+  static const uint32_t kMaxPressureShift = 6;
+
+  static EpochAdvancePolicy RingFraction(uint32_t ring_shift = 2) {
+    EpochAdvancePolicy policy{};
+    policy.kind = kRingFraction;
+    policy.ring_shift = ring_shift;
+    return policy;
+  }
+  static EpochAdvancePolicy Time(std::chrono::nanoseconds interval) {
+    EpochAdvancePolicy policy{};
+    policy.kind = kTime;
+    policy.interval = interval;
+    return policy;
+  }
+  static EpochAdvancePolicy RetireCount(uint64_t retire_count) {
+    EpochAdvancePolicy policy{};
+    policy.kind = kRetireCount;
+    policy.retire_count = retire_count;
+    return policy;
+  }
+  static EpochAdvancePolicy Pressure() {
+    EpochAdvancePolicy policy{};
+    policy.kind = kPressure;
+    return policy;
+  }
+  static EpochAdvancePolicy Custom(Callback callback, void* context) {
+    EpochAdvancePolicy policy{};
+    policy.kind = kCustom;
+    policy.callback = callback;
+    policy.context = context;
+    return policy;
+  }
+
+  Kind kind;
+  uint32_t ring_shift;
+
+  /// Must be a power of two.
+  uint64_t retire_count;
+  std::chrono::nanoseconds interval;
+  Callback callback;
+  void* context;
+
+  /// Minimum time between two on-demand recomputations of the safe epoch
+  /// by pushers that ran into an item not yet safe to reclaim; see
+  /// EpochManager::RefreshSafeToReclaimEpoch().
+  std::chrono::nanoseconds min_refresh_interval{std::chrono::microseconds(10)};
+};
+
 /// Used to ensure that concurrent accesses to data structures don't reuse
 /// memory that some threads may be accessing. Specifically, for many lock-free
 /// data structures items are "unlinked" when they are removed. Unlinked items
@@ -50,19 +143,96 @@ typedef uint64_t Epoch;
 /// accessing or ever will access the item again).
 class EpochManager {
  public:
+  /// Work a thread wants done every time it leaves the protected region of
+  /// this EpochManager, for example publishing items it retired while
+  /// protected. Hooks are linked into the calling thread's MinEpochTable
+  /// entry and are only ever touched by that thread, so no synchronization
+  /// is needed to walk or modify them.
+  struct UnprotectHook {
+    typedef void (*Callback)(UnprotectHook* hook);
+
+    /// Invoked with the hook itself after the thread has left the protected
+    /// region. The thread is unprotected while this runs.
+    Callback callback;
+
+    /// Next hook registered by the same thread.
+    UnprotectHook* next;
+
+    /// Table and TLS slot of the manager the hook is registered with;
+    /// #table_id is 0 while it is not registered, which includes after the
+    /// thread gave its entry back (e.g. ReleaseEntryForThread()).
+    uint64_t table_id;
+    uint32_t table_slot;
+  };
+
+  /// A checkpoint a long protected operation can be restarted from when the
+  /// reclaimer neutralizes it (see EnableNeutralization()). Lives on the
+  /// stack of the protected function; set with EPOCH_PROTECT_RESTARTABLE()
+  /// and released with UnprotectRestartable().
+  ///
+  /// On neutralization the thread's protection is dropped and execution
+  /// jumps back to the checkpoint, skipping destructors of everything in
+  /// between, so the region must only read shared state and must not hold
+  /// locks, allocate, or own objects with meaningful destructors while
+  /// armed. Use Disarm()/Arm() around parts that do (e.g. writes or calls
+  /// into the allocator); neutralization signals arriving then are ignored
+  /// and the reclaimer signals again on a later bump.
+  struct RestartPoint {
+    sigjmp_buf env;
+
+    /// Whether a neutralization may restart the operation right now.
+    volatile sig_atomic_t armed;
+
+    /// How often the operation has been restarted.
+    volatile uint64_t restarts;
+
+    void Arm() {
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+      armed = 1;
+    }
+    void Disarm() {
+      armed = 0;
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+
+    /// The calling thread's published epoch and nesting depth in the
+    /// manager the checkpoint was taken with, and the depth before it was.
+    /// Only a checkpoint taken at depth 0 owns the protection, so only such
+    /// a checkpoint can be restarted to release it.
+    std::atomic<Epoch>* protected_epoch;
+    uint32_t* nesting;
+    uint32_t outer_nesting;
+
+    /// Set in the thread's entry by that manager right before it signals
+    /// the thread; see OnNeutralizeSignal().
+    std::atomic<uint32_t>* neutralize_requested;
+
+    /// Set in the thread's entry while a checkpoint taken at depth 0 is
+    /// registered, i.e. while the thread may be neutralized at all.
+    std::atomic<uint32_t>* restartable;
+
+    /// Enclosing checkpoint of the same thread, of any manager.
+    RestartPoint* prev;
+  };
+
   EpochManager();
   ~EpochManager();
 
-  bool Initialize();
+  bool Initialize(bool asymmetric_fences = false, uint32_t nodes = 0);
   bool Uninitialize();
 
+  /// True if Protect() relies on the reclaiming side's membarrier() rather
+  /// than a fence of its own; see Initialize().
+  bool UsesAsymmetricFences();
+
   /// Enter the thread into the protected code region, which guarantees
   /// pointer stability for records in client data structures. After this
   /// call, accesses to protected data structure items are guaranteed to be
   /// safe, even if the item is concurrently removed from the structure.
   ///
-  /// Behavior is undefined if Protect() is called from an already
-  /// protected thread. Upon creation, threads are unprotected.
+  /// Calls nest: a thread that is already protected only bumps its nesting
+  /// depth and keeps the epoch it entered with, so independent layers can
+  /// each hold their own EpochGuard. Upon creation, threads are unprotected.
   /// \return S_OK indicates thread may now enter the protected region. Any
   ///      other return indicates a fatal problem accessing the thread local
   ///      storage; the thread may not enter the protected region. Most likely
@@ -73,8 +243,9 @@ class EpochManager {
   /// promise not to access pointers to elements in the protected data
   /// structures beyond this call.
   ///
-  /// Behavior is undefined if Unprotect() is called from an already
-  /// unprotected thread.
+  /// Only the call matching the outermost Protect() leaves the region; inner
+  /// ones just decrement the nesting depth. Behavior is undefined if
+  /// Unprotect() is called from an already unprotected thread.
   /// \return S_OK indicates thread successfully exited protected region. Any
   ///      other return indicates a fatal problem accessing the thread local
   ///      storage; the thread may not have successfully exited the protected
@@ -93,12 +264,107 @@ class EpochManager {
   /// concurrently accessed the object inquired about.
   bool IsSafeToReclaim(Epoch epoch);
 
-  /// Returns true if the calling thread is already in the protected code
-  /// region (i.e., have already called Protected()).
-  bool IsProtected();
+  /// Returns the newest epoch IsSafeToReclaim() currently accepts, for
+  /// callers that check many items at once.
+  Epoch GetSafeToReclaimEpoch();
+
+  /// Returns the calling thread's protection nesting depth: the number of
+  /// Protect() calls not yet matched by Unprotect(), so 0 if the thread is
+  /// outside the protected code region.
+  uint32_t IsProtected();
+
+  // -- Quiescent-state-based reclamation (QSBR) --
+  // Threads that do nothing but short reads can skip publishing an epoch on
+  // every operation: they go Online() once, call QuiescentState() between
+  // batches of operations (at points where they hold no references into
+  // protected structures) and go Offline() around blocking calls. An online
+  // thread looks to the table like a thread protected since its last
+  // quiescent state, so QSBR and Protect()/Unprotect() threads can share an
+  // EpochManager and its garbage lists.
+
+  /// Put the calling thread online. Counts as a level of protection, so
+  /// Protect()/EpochGuard used while online just nest.
+  bool Online();
+
+  /// Announce that the calling online thread holds no references into
+  /// protected structures, moving its published epoch up to the current one,
+  /// and run its unprotect hooks. Has no effect unless the thread is online
+  /// and not inside any Protect() or EpochGuard, whether taken before or
+  /// after Online(); those still hold references.
+  bool QuiescentState();
+
+  /// Take the calling thread offline, e.g. before blocking I/O. Must match
+  /// Online().
+  bool Offline();
+
+  /// Let BumpCurrentEpoch() neutralize threads whose published epoch trails
+  /// the current one by more than \a max_lag epochs and whose protection
+  /// was taken by a RestartPoint: they are sent \a signal, once per
+  /// request, and if the RestartPoint is armed they give up their
+  /// protection and restart from it. Threads protected otherwise (guards,
+  /// Online()) are never signalled. Installs a process-wide handler for
+  /// \a signal.
+  ///
+  /// \retval false The signal handler could not be installed.
+  bool EnableNeutralization(Epoch max_lag, int signal = SIGUSR2);
+
+  /// Protect() and register \a point as the calling thread's restart
+  /// checkpoint; use through EPOCH_PROTECT_RESTARTABLE().
+  bool ProtectRestartable(RestartPoint* point);
+
+  /// Unregister \a point and Unprotect().
+  bool UnprotectRestartable(RestartPoint* point);
+
+  /// Run \a hook's callback every time the calling thread completes an
+  /// Unprotect() on this EpochManager. The hook must stay valid until it is
+  /// unregistered by the same thread.
+  bool RegisterUnprotectHook(UnprotectHook* hook);
+
+  /// Stop running \a hook on Unprotect(); must be called by the thread that
+  /// registered it. Does nothing (and returns false) if the hook is not
+  /// registered or the manager it was registered with has been uninitialized
+  /// or destroyed meanwhile, in which case nothing can run it any more.
+  static bool UnregisterUnprotectHook(UnprotectHook* hook);
 
   void BumpCurrentEpoch();
 
+  /// Replace the default epoch advance policy (a bump every quarter ring).
+  /// Not synchronized with retiring threads; set it before items are
+  /// retired.
+  ///
+  /// A ring whose contents span few epochs fills up with unreclaimable
+  /// items as soon as one pusher stalls inside its guard, so policies that
+  /// bump only a few times per lap (e.g. a long kTime interval on a small
+  /// ring) trade table scans for that risk.
+  ///
+  /// \retval false \a policy is malformed (e.g. a retire count that is not
+  ///      a power of two or a custom policy without callback).
+  bool SetAdvancePolicy(const EpochAdvancePolicy& policy);
+
+  /// Consulted by garbage lists for the slot of \a ticket in a ring of
+  /// \a ring_size slots; returns true if the caller should
+  /// BumpCurrentEpoch().
+  bool ShouldAdvance(int64_t ticket, uint64_t ring_size);
+
+  /// Called by a retiring thread that ran into an item of \a epoch that is
+  /// not safe to reclaim per the cached safe epoch. Rescans the table if no
+  /// other thread did so within the policy's min_refresh_interval (and
+  /// none is scanning right now), and under kPressure bumps the epoch if
+  /// the item belongs to the current one. Returns IsSafeToReclaim(epoch)
+  /// afterwards.
+  bool RefreshSafeToReclaimEpoch(Epoch epoch);
+
+  /// Fill \a stats with the current and safe-to-reclaim epochs and, in
+  /// EPOCH_STATS builds, the manager's and its table's counters. Fields
+  /// belonging to GarbageList are zeroed; see GarbageList::GetStats().
+  void GetStats(ReclamationStats* stats);
+
+#ifdef EPOCH_STATS
+  /// When \a epoch started, in StatNanoseconds(), or 0 if it is too old to
+  /// be remembered.
+  uint64_t GetEpochStartTime(Epoch epoch);
+#endif
+
  public:
   void ComputeNewSafeToReclaimEpoch(Epoch currentEpoch);
 
@@ -120,8 +386,33 @@ class EpochManager {
     /// Default number of entries managed by the MinEpochTable
     static const uint64_t kDefaultSize = 128;
 
+    /// Maximum number of equally sized segments the table may grow to.
+    /// With the default size this allows 32K concurrently registered
+    /// threads before Protect() starts failing.
+    static const uint64_t kMaxSegments = 256;
+
+    /// How many epochs an entry must have been idle (judged from its
+    /// last_unprotected_epoch against the most recent epoch reported by
+    /// any entry) before ReclaimOldEntries() checks whether its owner is
+    /// still alive.
+    static const uint64_t kStaleEntryEpochs = 4;
+
+    /// Maximum number of NUMA nodes the table keeps separate sub-tables for.
+    static const uint32_t kMaxNodes = 64;
+
+    /// Remote nodes' min-epoch summaries are trusted for this many epochs
+    /// before ComputeNewSafeToReclaimEpoch() rescans their entries itself.
+    static const uint64_t kNodeSummaryMaxAge = 2;
+
+    /// Maximum number of tables (and so EpochManagers) that may be
+    /// initialized at the same time. Every thread keeps one cached entry
+    /// pointer per table, so this bounds per-thread TLS size.
+    static const uint32_t kMaxTables = 128;
+
     MinEpochTable();
-    bool Initialize(uint64_t size = MinEpochTable::kDefaultSize);
+    ~MinEpochTable();
+    bool Initialize(uint64_t size = MinEpochTable::kDefaultSize,
+                    uint32_t nodes = 0, bool asymmetric_fences = false);
     bool Uninitialize();
     bool Protect(Epoch currentEpoch);
     bool Unprotect(Epoch currentEpoch);
@@ -170,17 +461,44 @@ class EpochManager {
       /// XXX(tzwang): on Linux pthread_t is 64-bit
       std::atomic<uint64_t> thread_id;  //  8 bytes
 
-      /// Ensure that each Entry is CACHELINE_SIZE.
-      char ___padding[40];
+      /// Hooks the owning thread runs after each Unprotect(). Only the
+      /// owning thread reads or writes this list.
+      UnprotectHook* unprotect_hooks;  //  8 bytes
+
+      /// Kernel thread id of the owner, used by ReclaimOldEntries() to tell
+      /// whether a stale entry's thread has exited without releasing it.
+      std::atomic<int32_t> os_thread_id;  //  4 bytes
+
+      /// Where this entry lives: its node's sub-table and its index there.
+      /// Fixed when the segment is created.
+      uint32_t node_id;  //  4 bytes
+      uint32_t index;    //  4 bytes
 
-      // -- Allocation policy to ensure alignment --
+      /// Number of Protect() calls by the owner not yet matched by an
+      /// Unprotect(). Only the owning thread touches it; protected_epoch is
+      /// published when it leaves 0 and cleared when it returns to 0.
+      uint32_t nesting;  //  4 bytes
 
-      /// Provides cacheline aligned allocation for the table.
-      /// Note: We'll want to be even smarter for NUMA. We'll want to
-      /// allocate slots that reside in socket-local DRAM to threads.
-      void* operator new[](uint64_t count);
+      /// Set by SignalLaggingThreads() before it signals the owner, so the
+      /// owner's signal handler can tell which of its managers asked; while
+      /// set, the owner is not signalled again.
+      std::atomic<uint32_t> neutralize_requested;  //  4 bytes
 
-      void operator delete[](void* p);
+      /// 1 while the owner's protection was taken by a RestartPoint, so
+      /// that SignalLaggingThreads() leaves every other thread alone.
+      std::atomic<uint32_t> restartable;  //  4 bytes
+
+      /// Number of Online() calls by the owner not yet matched by an
+      /// Offline(), each of which also counts in #nesting. Only the owning
+      /// thread touches it.
+      uint32_t online;  //  4 bytes
+
+      /// Ensure that each Entry is CACHELINE_SIZE.
+      char ___padding[4];
+
+      // -- Allocation policy --
+      // Entries are only ever created in whole segments placed on a NUMA
+      // node by AllocateOnNode().
 
       /// Don't allow single-entry allocations. We don't ever do them.
       /// No definition is provided so that programs that do single
@@ -200,44 +518,267 @@ class EpochManager {
     Entry* ReserveEntry(uint64_t startIndex, uint64_t threadId);
     Entry* ReserveEntryForThread();
     void ReleaseEntryForThread();
-    void ReclaimOldEntries();
-    bool IsProtected();
+    uint64_t ReclaimOldEntries();
+    uint32_t IsProtected();
+    bool Online(Epoch currentEpoch);
+    bool QuiescentState(Epoch currentEpoch);
+    bool Offline(Epoch currentEpoch);
+    bool RegisterUnprotectHook(UnprotectHook* hook);
+    static bool UnregisterUnprotectHook(UnprotectHook* hook);
+    uint64_t SignalLaggingThreads(Epoch threshold, int signal);
+    bool UsesAsymmetricFences() { return asymmetric_fences_; }
+
+    /// Add the table's counters to \a stats (EPOCH_STATS builds only).
+    void AddStats(ReclamationStats* stats);
 
    private:
+    /// What a thread remembers about the entry it reserved in one table.
+    /// #table_id is 0 unless #entry is valid, so a slot left behind by a
+    /// table that was since uninitialized (and whose slot was reused) is
+    /// never mistaken for an entry of the new table.
+    struct ThreadEntry {
+      uint64_t table_id;
+      Entry* entry;
+      MinEpochTable* table;
+    };
 
-    /// Thread protection status entries. Threads lock entries the first time
-    /// the call Protect() (see reserveEntryForThread()). See documentation for
-    /// the fields to specifics of how threads use their Entries to guarantee
-    /// memory-stability.
-    Entry* table_;
+    /// Releases the thread's entries when the thread exits so that thread
+    /// churn does not exhaust the tables.
+    struct ThreadEntryReleaser {
+      ~ThreadEntryReleaser();
+    };
+
+    /// Entries of the threads that reserved them while running on one NUMA
+    /// node, plus a summary of their minimum protected epoch. A NodeTable and
+    /// its segments live in that node's memory, so Protect()/Unprotect()
+    /// stores stay socket-local and reclaimers on other sockets usually only
+    /// read the summary line instead of every entry.
+    struct alignas(CACHELINE_SIZE) NodeTable {
+      /// Entries in fixed-size segments appended as the node fills up.
+      /// Installed segments are never moved or freed before Uninitialize(),
+      /// so threads may keep pointers to their entries.
+      std::atomic<Entry*> segments[kMaxSegments];
+
+      /// Number of entries in installed segments.
+      std::atomic<uint64_t> capacity;
+
+      /// One past the highest entry index ever reserved. Entries are
+      /// reserved first-fit, so live entries stay packed below this mark
+      /// and scans never need to look beyond it.
+      std::atomic<uint64_t> high_water;
+
+      /// Which node this sub-table (and every segment of it) lives on.
+      uint32_t node_id;
+
+      /// One bit per entry index, set while the entry is owned by a thread.
+      /// Updated only when entries are reserved or released, so scans can
+      /// skip free entries without touching their cachelines.
+      std::atomic<uint64_t>* occupancy;
+
+      /// Lower bound on the protected epoch of every thread on this node,
+      /// computed by ScanNode() when the global epoch was #summary_epoch.
+      /// Threads protecting later do so with a later epoch, so an old
+      /// summary stays a valid (if conservative) bound. Kept on its own
+      /// cacheline since remote reclaimers poll it.
+      alignas(CACHELINE_SIZE) std::atomic<Epoch> min_epoch;
+
+      /// Epoch the summary was computed for; 0 if it never was.
+      std::atomic<Epoch> summary_epoch;
+    };
 
-    /// The number of entries #m_table. Currently, this is fixed after
-    /// Initialize() and never changes or grows. If #m_table runs out
-    /// of entries, then the current implementation will deadlock threads.
+    /// Locates entry \a index of \a node; it must be below its capacity.
+    Entry& EntryAt(NodeTable& node, uint64_t index);
+
+    /// Install the segment following the first \a capacity entries of
+    /// \a node, unless another thread already did. Returns false when the
+    /// node is at kMaxSegments or out of memory.
+    bool Grow(NodeTable& node, uint64_t capacity);
+
+    /// ReserveEntry() restricted to \a node; returns nullptr once the node
+    /// is full and cannot grow any further.
+    Entry* ReserveEntryOnNode(NodeTable& node, uint64_t start_index,
+                              uint64_t thread_id);
+
+    /// Minimum protected epoch on \a node (or \a current_epoch if lower);
+    /// refreshes the node's summary.
+    Epoch ScanNode(NodeTable& node, Epoch current_epoch);
+
+    /// The sub-table the calling thread should reserve from.
+    uint32_t CurrentNode();
+
+    /// Allocate and construct a segment of #size_ entries on \a node whose
+    /// first entry has index \a first_index.
+    Entry* NewSegment(uint32_t node, uint64_t first_index);
+
+    /// Out-of-line slow path of GetEntryForThread().
+    bool CacheEntryForThread(Entry** entry);
+
+    /// Publish \a current_epoch as \a entry's protected epoch, ordered
+    /// before the thread's later loads.
+    void PublishEpoch(Entry* entry, Epoch current_epoch);
+
+    /// Run the unprotect hooks registered on \a entry.
+    static void RunUnprotectHooks(Entry* entry);
+
+    /// Unregister every hook of the calling thread's \a entry.
+    static void DropUnprotectHooks(Entry* entry);
+
+    /// Size of a NodeTable's occupancy bitmap.
+    uint64_t OccupancyBytes();
+
+    /// Page-aligned allocation whose memory is preferably placed on
+    /// \a node; returns nullptr on failure.
+    void* AllocateOnNode(uint64_t bytes, uint32_t node);
+
+    /// Number of NUMA nodes in the system (at least 1).
+    static uint32_t DetectNodeCount();
+
+    /// Register the process for private expedited membarrier(); false if the
+    /// kernel does not support it.
+    static bool RegisterMembarrier();
+
+    /// Return \a entry to the pool of unowned entries.
+    void ReleaseEntry(Entry* entry);
+
+    /// One sub-table per NUMA node, each allocated on its node.
+    NodeTable* nodes_[kMaxNodes];
+
+    /// Number of valid #nodes_.
+    uint32_t node_count_;
+
+    /// True if #node_count_ was forced to differ from the real topology;
+    /// threads are then spread over sub-tables by CPU instead of by node.
+    bool emulate_nodes_;
+
+    /// True if Protect() only orders its store against the compiler and
+    /// ComputeNewSafeToReclaimEpoch() makes it visible with membarrier().
+    bool asymmetric_fences_;
+
+    /// The number of entries in each segment. Always a power of two.
     uint64_t size_;
+
+    /// Process-unique id, so that exiting threads can tell whether the table
+    /// that owns their entry is still alive.
+    uint64_t id_;
+
+    /// Index of this table's cached entry in every thread's #tls_entries_;
+    /// assigned by Initialize() and freed by Uninitialize().
+    uint32_t slot_;
+
+    inline static std::atomic<uint64_t> next_table_id_{1};
+
+    /// Id of the initialized table owning each TLS slot, 0 if the slot is
+    /// free; guarded by #live_tables_mutex_.
+    inline static uint64_t live_tables_[kMaxTables];
+    inline static std::mutex live_tables_mutex_;
+
+    /// Defined inline so the Protect()/Unprotect() fast path compiled into
+    /// other translation units is a direct TLS access rather than a call
+    /// through the TLS wrapper.
+    inline static thread_local ThreadEntry tls_entries_[kMaxTables];
+    static thread_local ThreadEntryReleaser tls_entry_releaser_;
+
+#ifdef EPOCH_STATS
+    enum Stat {
+      kStatProtects,
+      kStatEntriesReserved,
+      kStatEntriesScanned,
+      kStatCount
+    };
+    StatCounters<kStatCount> stats_;
+#endif
   };
 
+  // The members below are grouped by who writes them, one group per
+  // cacheline, so that bumps and scans do not invalidate the lines every
+  // Protect() and IsSafeToReclaim() reads.
+
+  /// Keeps track of which threads are executing in region protected by
+  /// its parent EpochManager. On Protect() and Unprotect() by a thread it
+  /// updates the table entry that tracks whether the thread is currently
+  /// operating in the protected region, and, if so, a conservative estimate
+  /// of how early it might have entered. See MinEpochTable for more details.
+  /// Read-mostly, like the rest of this line.
+  MinEpochTable* epoch_table_;
+
+  /// See SetAdvancePolicy().
+  EpochAdvancePolicy advance_policy_;
+
+  /// See EnableNeutralization(); #neutralize_lag_ is 0 while disabled.
+  Epoch neutralize_lag_;
+  int neutralize_signal_;
+
   /// A notion of time for objects that are removed from data structures.
   /// Objects in data structures are timestamped with this Epoch just after
   /// they have been (sequentially consistently) "unlinked" from a structure.
   /// Threads also use this Epoch to mark their entry into a protected region
   /// (also in sequentially consistent way). While a thread operates in this
   /// region "unlinked" items that they may be accessing will not be reclaimed.
-  std::atomic<Epoch> current_epoch_;
+  alignas(very_pm::kCacheLineSize) std::atomic<Epoch> current_epoch_;
 
   /// Caches the most recent result of ComputeNewSafeToReclaimEpoch() so
   /// that fast decisions about whether an object can be reused or not
   /// (in IsSafeToReclaim()). Effectively, this is periodically computed
   /// by taking the minimum of the protected Epochs in #m_epochTable and
   /// #current_epoch_.
-  std::atomic<Epoch> safe_to_reclaim_epoch_;
+  alignas(very_pm::kCacheLineSize) std::atomic<Epoch> safe_to_reclaim_epoch_;
 
-  /// Keeps track of which threads are executing in region protected by
-  /// its parent EpochManager. On Protect() and Unprotect() by a thread it
-  /// updates the table entry that tracks whether the thread is currently
-  /// operating in the protected region, and, if so, a conservative estimate
-  /// of how early it might have entered. See MinEpochTable for more details.
-  MinEpochTable* epoch_table_;
+  /// Scan coalescing (see CoalescedComputeSafeEpoch()): the newest epoch a
+  /// scan was asked for, and whether some thread is scanning.
+  alignas(very_pm::kCacheLineSize) std::atomic<Epoch> scan_requested_;
+  std::atomic<bool> scanning_;
+
+  /// When the epoch last advanced and the safe epoch was last computed, in
+  /// NowNanoseconds(). Written by bumps and refreshes only.
+  alignas(very_pm::kCacheLineSize) std::atomic<uint64_t> last_advance_ns_;
+  std::atomic<uint64_t> last_refresh_ns_;
+
+  /// kPressure: log2 of the bumps per ring lap, and whether a pusher was
+  /// held up by an unsafe item since the last bump.
+  std::atomic<uint32_t> pressure_shift_;
+  std::atomic<bool> pressure_blocked_;
+
+  /// Monotonic clock for the advance policy.
+  static uint64_t NowNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /// Common tail of every bump: \a newEpoch was current until the bump.
+  void OnEpochAdvanced(Epoch newEpoch);
+
+  /// ComputeNewSafeToReclaimEpoch(), unless another thread is scanning
+  /// already and takes the request over.
+  void CoalescedComputeSafeEpoch(Epoch currentEpoch);
+
+  /// kTime: whether the epoch is due, electing one caller per interval.
+  bool TimeToAdvance();
+
+  /// Innermost RestartPoint of the calling thread, across all managers;
+  /// the others are chained through RestartPoint::prev.
+  inline static thread_local RestartPoint* tls_restart_point_;
+
+  /// Handler for the neutralization signal.
+  static void OnNeutralizeSignal(int signal);
+
+#ifdef EPOCH_STATS
+  enum Stat {
+    kStatEpochBumps,
+    kStatSafeEpochComputations,
+    kStatNeutralizeSignals,
+    kStatSafeEpochRefreshes,
+    kStatCoalescedScans,
+    kStatCount
+  };
+  StatCounters<kStatCount> stats_;
+
+  /// Number of recent epochs whose start time is remembered.
+  static const uint64_t kEpochTimes = 1024;
+
+  /// Start time of epoch e at [e % kEpochTimes], set by BumpCurrentEpoch().
+  std::atomic<uint64_t> epoch_start_times_[kEpochTimes];
+#endif
 
   EpochManager(const EpochManager&) = delete;
   EpochManager(EpochManager&&) = delete;
@@ -247,7 +788,10 @@ class EpochManager {
 
 /// Enters an epoch on construction and exits it on destruction. Makes it
 /// easy to ensure epoch protection boundaries tightly adhere to stack life
-/// time even with complex control flow.
+/// time even with complex control flow. Guards nest: a guard created while
+/// the thread is already protected (by another guard or by Protect()) only
+/// adjusts the thread's nesting depth, so each layer of a call chain can
+/// simply take its own guard.
 class EpochGuard {
  public:
   explicit EpochGuard(EpochManager* epoch_manager);
@@ -271,3 +815,294 @@ class EpochGuard {
   /// Whether the guard should call unprotect when going out of scope.
   bool unprotect_at_exit_;
 };
+
+// -- Read-side fast path --
+// Protect()/Unprotect() and the guards built on them are defined here so that
+// they inline into callers: a TLS load of the cached entry, a load of the
+// global epoch and a store to the entry. Reserving an entry stays in
+// epoch_manager.cpp.
+
+inline bool EpochManager::Protect() {
+  return epoch_table_->Protect(current_epoch_.load(std::memory_order_relaxed));
+}
+inline bool EpochManager::Unprotect() {
+  return epoch_table_->Unprotect(
+      current_epoch_.load(std::memory_order_relaxed));
+}
+inline bool EpochManager::ProtectRestartable(RestartPoint* point) {
+  if (!Protect()) return false;
+  MinEpochTable::Entry* entry = nullptr;
+  epoch_table_->GetEntryForThread(&entry);
+  point->protected_epoch = &entry->protected_epoch;
+  point->nesting = &entry->nesting;
+  point->outer_nesting = entry->nesting - 1;
+  point->neutralize_requested = &entry->neutralize_requested;
+  point->restartable = &entry->restartable;
+  // A request left over from an earlier region of this manager is moot.
+  if (!point->outer_nesting) {
+    entry->neutralize_requested.store(0, std::memory_order_relaxed);
+    entry->restartable.store(1, std::memory_order_relaxed);
+  }
+  point->prev = tls_restart_point_;
+  point->armed = 1;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  tls_restart_point_ = point;
+  return true;
+}
+inline bool EpochManager::UnprotectRestartable(RestartPoint* point) {
+  tls_restart_point_ = point->prev;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  if (!point->outer_nesting) {
+    point->restartable->store(0, std::memory_order_relaxed);
+  }
+  return Unprotect();
+}
+
+inline bool EpochManager::Online() {
+  return epoch_table_->Online(current_epoch_.load(std::memory_order_relaxed));
+}
+inline bool EpochManager::QuiescentState() {
+  return epoch_table_->QuiescentState(
+      current_epoch_.load(std::memory_order_relaxed));
+}
+inline bool EpochManager::Offline() {
+  return epoch_table_->Offline(current_epoch_.load(std::memory_order_relaxed));
+}
+inline Epoch EpochManager::GetCurrentEpoch() {
+  return current_epoch_.load(std::memory_order_seq_cst);
+}
+inline bool EpochManager::IsSafeToReclaim(Epoch epoch) {
+  return epoch <= safe_to_reclaim_epoch_.load(std::memory_order_relaxed);
+}
+inline Epoch EpochManager::GetSafeToReclaimEpoch() {
+  return safe_to_reclaim_epoch_.load(std::memory_order_relaxed);
+}
+inline bool EpochManager::ShouldAdvance(int64_t ticket, uint64_t ring_size) {
+  // Every half lap regardless; see EpochAdvancePolicy.
+  if ((((ticket - 1) << 1) & (ring_size - 1)) == 0) return true;
+  switch (advance_policy_.kind) {
+    case EpochAdvancePolicy::kRingFraction:
+      return (((ticket - 1) << advance_policy_.ring_shift) &
+              (ring_size - 1)) == 0;
+    case EpochAdvancePolicy::kTime:
+      if (ticket & (EpochAdvancePolicy::kTimeCheckTickets - 1)) return false;
+      return TimeToAdvance();
+    case EpochAdvancePolicy::kRetireCount:
+      return ((ticket - 1) & (advance_policy_.retire_count - 1)) == 0;
+    case EpochAdvancePolicy::kPressure: {
+      uint32_t shift = pressure_shift_.load(std::memory_order_relaxed);
+      return (((ticket - 1) << shift) & (ring_size - 1)) == 0;
+    }
+    case EpochAdvancePolicy::kCustom:
+      return advance_policy_.callback(advance_policy_.context, ticket,
+                                      ring_size);
+  }
+  return false;
+}
+inline uint32_t EpochManager::IsProtected() {
+  return epoch_table_->IsProtected();
+}
+
+/**
+ * Get a pointer to the thread-specific state needed for a thread to
+ * Protect()/Unprotect(). If no thread-specific Entry has been allocated
+ * yet, then one it transparently allocated and its address is stashed
+ * in the thread's local storage.
+ *
+ * \param[out] entry Points to an address that is populated with
+ *      a pointer to the thread's Entry upon return. It is illegal to
+ *      pass nullptr.
+ * \return S_OK if the thread's entry was discovered or allocated; in such
+ *      a successful call \a entry points to a pointer to the Entry.
+ *      Any other return value means there was a problem accessing or
+ *      setting values in the thread's local storage. The value pointed
+ *      to by entry remains unchanged, but the library may have entered
+ *      a non-serviceable state.
+ */
+inline bool EpochManager::MinEpochTable::GetEntryForThread(Entry** entry) {
+  ThreadEntry& tls = tls_entries_[slot_];
+  if (tls.table_id == id_) {
+    *entry = tls.entry;
+    return true;
+  }
+  return CacheEntryForThread(entry);
+}
+
+/**
+ * Enter the thread into the protected code region, which guarantees
+ * pointer stability for records in client data structures. After this
+ * call, accesses to protected data structure items are guaranteed to be
+ * safe, even if the item is concurrently removed from the structure.
+ *
+ * If the thread is already protected this only increments its nesting
+ * depth; the epoch it entered with stays published, which is conservative
+ * for the inner caller. Upon creation, threads are unprotected.
+ *
+ * \param currentEpoch A sequentially consistent snapshot of the current
+ *      global epoch. It is okay that this may be stale by the time it
+ *      actually gets entered into the table.
+ * \return S_OK indicates thread may now enter the protected region. Any
+ *      other return indicates a fatal problem accessing the thread local
+ *      storage; the thread may not enter the protected region. Most likely
+ *      the library has entered some non-serviceable state.
+ */
+inline bool EpochManager::MinEpochTable::Protect(Epoch current_epoch) {
+  Entry* entry = nullptr;
+  if (!GetEntryForThread(&entry)) {
+    return false;
+  }
+  if (entry->nesting++) return true;
+  EPOCH_STAT(stats_.Add(kStatProtects));
+
+  entry->last_unprotected_epoch = 0;
+  PublishEpoch(entry, current_epoch);
+  return true;
+}
+
+inline void EpochManager::MinEpochTable::PublishEpoch(Entry* entry,
+                                                      Epoch current_epoch) {
+  entry->protected_epoch.store(current_epoch, std::memory_order_relaxed);
+  // The store must be visible to reclaimers before this thread loads any
+  // shared pointer, i.e. store-load ordering, which only a full fence gives.
+  // In asymmetric mode the reclaimer's membarrier() forces that ordering on
+  // every running thread before it scans, so keeping the compiler from
+  // hoisting later loads above the store is enough here.
+  if (asymmetric_fences_) {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+  } else {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+}
+
+/**
+ * Exit the thread from the protected code region. The thread must
+ * promise not to access pointers to elements in the protected data
+ * structures beyond this call.
+ *
+ * Unless this matches the thread's outermost Protect() it only decrements
+ * the nesting depth. Behavior is undefined if Unprotect() is called from an
+ * already unprotected thread.
+ *
+ * \param currentEpoch A any rough snapshot of the current global epoch, so
+ *      long as it is greater than or equal to the value used on the thread's
+ *      corresponding call to Protect().
+ * \return S_OK indicates thread successfully exited protected region. Any
+ *      other return indicates a fatal problem accessing the thread local
+ *      storage; the thread may not have successfully exited the protected
+ *      region. Most likely the library has entered some non-serviceable
+ *      state.
+ */
+inline bool EpochManager::MinEpochTable::Unprotect(Epoch currentEpoch) {
+  Entry* entry = nullptr;
+  if (!GetEntryForThread(&entry)) {
+    return false;
+  }
+  if (--entry->nesting) return true;
+
+  entry->last_unprotected_epoch = currentEpoch;
+  std::atomic_thread_fence(std::memory_order_release);
+  entry->protected_epoch.store(0, std::memory_order_relaxed);
+  RunUnprotectHooks(entry);
+  return true;
+}
+
+/**
+ * Put the thread online (QSBR): Protect() and remember that this level of
+ * protection belongs to Online(), so QuiescentState() may advance it.
+ */
+inline bool EpochManager::MinEpochTable::Online(Epoch currentEpoch) {
+  if (!Protect(currentEpoch)) return false;
+  Entry* entry = nullptr;
+  GetEntryForThread(&entry);
+  ++entry->online;
+  return true;
+}
+
+/**
+ * Report a quiescent state for an online (QSBR) thread: it holds no
+ * references into protected structures, so its published epoch can move up
+ * to \a currentEpoch. Does nothing unless every level of the thread's
+ * protection was taken by Online(); offline threads publish nothing, and
+ * threads inside a Protect() (e.g. an EpochGuard in library code) still
+ * hold references.
+ *
+ * \param currentEpoch A snapshot of the current global epoch.
+ * \return false if the thread's entry could not be found or reserved.
+ */
+inline bool EpochManager::MinEpochTable::QuiescentState(Epoch currentEpoch) {
+  Entry* entry = nullptr;
+  if (!GetEntryForThread(&entry)) {
+    return false;
+  }
+  if (!entry->online || entry->nesting != entry->online) return true;
+
+  // As in Unprotect(), the thread's earlier loads of shared pointers must
+  // not be reordered after the store that lets reclaimers free them.
+  std::atomic_thread_fence(std::memory_order_release);
+  PublishEpoch(entry, currentEpoch);
+  RunUnprotectHooks(entry);
+  return true;
+}
+
+/**
+ * Take the thread offline: drop the level of protection the matching
+ * Online() took.
+ */
+inline bool EpochManager::MinEpochTable::Offline(Epoch currentEpoch) {
+  Entry* entry = nullptr;
+  if (!GetEntryForThread(&entry)) {
+    return false;
+  }
+  --entry->online;
+  return Unprotect(currentEpoch);
+}
+
+inline void EpochManager::MinEpochTable::RunUnprotectHooks(Entry* entry) {
+  // Hooks may unregister themselves, so fetch the successor first.
+  for (UnprotectHook* hook = entry->unprotect_hooks; hook;) {
+    UnprotectHook* next = hook->next;
+    hook->callback(hook);
+    hook = next;
+  }
+}
+
+inline uint32_t EpochManager::MinEpochTable::IsProtected() {
+  Entry* entry = nullptr;
+  if (!GetEntryForThread(&entry)) return 0;
+  // Only the owning thread ever touches its nesting depth.
+  return entry->nesting;
+}
+
+inline EpochGuard::EpochGuard(EpochManager* epoch_manager)
+    : epoch_manager_{epoch_manager}, unprotect_at_exit_(true) {
+  epoch_manager_->Protect();
+}
+inline EpochGuard::EpochGuard(EpochManager* epoch_manager, bool protect)
+    : epoch_manager_{epoch_manager}, unprotect_at_exit_(protect) {
+  if (protect) {
+    epoch_manager_->Protect();
+  }
+}
+inline EpochGuard::~EpochGuard() {
+  if (unprotect_at_exit_ && epoch_manager_) {
+    epoch_manager_->Unprotect();
+  }
+}
+inline EpochManager* EpochGuard::Release() {
+  EpochManager* ret = epoch_manager_;
+  epoch_manager_ = nullptr;
+  return ret;
+}
+
+/// Enter \a manager's protected region with \a point (an
+/// EpochManager::RestartPoint) as the restart checkpoint. If the thread is
+/// neutralized, execution resumes right here with a fresh protection, so
+/// everything after this statement up to UnprotectRestartable() must be safe
+/// to run again from scratch; as with any setjmp, non-volatile locals
+/// modified after the checkpoint are indeterminate after a restart. A
+/// statement; the sigsetjmp() call has to sit in the caller's frame.
+#define EPOCH_PROTECT_RESTARTABLE(manager, point) \
+  do {                                            \
+    (void)sigsetjmp((point)->env, 1);             \
+    (manager)->ProtectRestartable(point);         \
+  } while (0)
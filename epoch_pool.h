@@ -0,0 +1,287 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include "garbage_list.h"
+
+/// Type-stable object pool whose objects are recycled through a GarbageList.
+///
+/// Retiring an object with a plain destroy callback that calls free() hands
+/// the memory back to the allocator, usually from a thread other than the
+/// one that will malloc() the next object, and pays for both calls. With an
+/// EpochPool the destroy callback instead runs ~T() and puts the memory on
+/// the reclaiming thread's free list, where the next Allocate() on that
+/// thread picks it up. Memory is never returned to the system while the pool
+/// is initialized, so it stays type-stable.
+///
+/// Each thread caches at most the configured number of free objects per
+/// pool, in two magazines of half that size (Bonwick's magazine layer). When
+/// both are full, the older one goes to the pool's shared list as a whole.
+/// A thread whose magazines are empty takes a full one from there before
+/// falling back to the system allocator. So a thread that only reclaims
+/// (e.g. a GarbageList reclaimer) feeds the threads that only allocate, at
+/// the cost of one lock per magazine and without walking any free list.
+///
+/// Typical use:
+///
+///   pool.Attach(&garbage_list);
+///   Node* node = pool.Allocate(key, value);
+///   ...  // unlink node
+///   pool.Retire(&garbage_list, node);
+template <typename T>
+class EpochPool {
+ public:
+  /// Default number of free objects a thread keeps per pool.
+  inline static const constexpr uint32_t kDefaultCacheSize = 256;
+
+  EpochPool() : magazine_size_{}, allocated_{}, initialized_{} {}
+  ~EpochPool() { Uninitialize(); }
+
+  EpochPool(const EpochPool&) = delete;
+  EpochPool& operator=(const EpochPool&) = delete;
+
+  /// Initialize the pool; every thread keeps up to \a cache_size free
+  /// objects.
+  ///
+  /// \retval false \a cache_size was smaller than 2.
+  bool Initialize(uint32_t cache_size = kDefaultCacheSize) {
+    if (initialized_) return true;
+    if (cache_size < 2) return false;
+    magazine_size_ = cache_size / 2;
+    allocated_.store(0, std::memory_order_relaxed);
+    initialized_ = true;
+    return true;
+  }
+
+  /// Give all free memory back to the system. Objects still allocated are
+  /// not tracked and must not be freed through the pool afterwards, so
+  /// retire lists feeding it have to be drained or uninitialized first.
+  bool Uninitialize() {
+    if (!initialized_) return true;
+    {
+      std::unique_lock<std::mutex> lock(caches_mutex_);
+      for (ThreadCache* cache : caches_) {
+        FreeChain(cache->loaded.head);
+        FreeChain(cache->previous.head);
+        cache->loaded = Magazine{};
+        cache->previous = Magazine{};
+        cache->owner = nullptr;
+      }
+      caches_.clear();
+    }
+    {
+      std::unique_lock<std::mutex> lock(magazines_mutex_);
+      for (Magazine& magazine : magazines_) FreeChain(magazine.head);
+      magazines_.clear();
+    }
+    initialized_ = false;
+    return true;
+  }
+
+  /// Construct a T from \a args in memory taken from the calling thread's
+  /// cache, the shared list or, if both are empty, the system allocator.
+  ///
+  /// \return The new object, or nullptr if memory ran out.
+  template <typename... Args>
+  T* Allocate(Args&&... args) {
+    ThreadCache* cache = GetThreadCache();
+    Magazine& loaded = cache->loaded;
+    if (!loaded.head) Refill(cache);
+
+    void* memory = loaded.head;
+    if (memory) {
+      loaded.head = loaded.head->next;
+      --loaded.count;
+    } else {
+      if (posix_memalign(&memory, kBlockAlignment, kBlockSize)) return nullptr;
+      allocated_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return new (memory) T(std::forward<Args>(args)...);
+  }
+
+  /// Destroy \a object and recycle its memory right away. Only for objects
+  /// no other thread can reach any more; use Retire() otherwise.
+  void Free(T* object) {
+    object->~T();
+    ThreadCache* cache = GetThreadCache();
+    Recycle(cache, object);
+  }
+
+  /// Push \a object to \a list so that it is destroyed and its memory
+  /// recycled once no thread can access it any more.
+  bool Retire(IGarbageList* list, T* object) {
+    return list->Push(object, &EpochPool::DestroyCallback, this);
+  }
+
+  /// Let \a list return batches of objects retired to this pool with one
+  /// call instead of one per object.
+  bool Attach(GarbageList* list) {
+    return list->RegisterBatchDestroyCallback(&EpochPool::DestroyCallback,
+                                              &EpochPool::BatchDestroyCallback);
+  }
+
+  /// IGarbageList::DestroyCallback that hands an object back to the pool
+  /// given as \a context.
+  static void DestroyCallback(void* context, void* object) {
+    static_cast<EpochPool*>(context)->Free(static_cast<T*>(object));
+  }
+
+  /// IGarbageList::BatchDestroyCallback counterpart of DestroyCallback().
+  static void BatchDestroyCallback(void* context, void** objects,
+                                   size_t count) {
+    EpochPool* pool = static_cast<EpochPool*>(context);
+    ThreadCache* cache = pool->GetThreadCache();
+    for (size_t i = 0; i < count; ++i) {
+      T* object = static_cast<T*>(objects[i]);
+      object->~T();
+      pool->Recycle(cache, object);
+    }
+  }
+
+  /// Number of objects the pool has taken from the system allocator.
+  uint64_t GetAllocatedCount() const {
+    return allocated_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  /// What a free object's memory holds while it sits on a free list.
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  inline static const constexpr size_t kBlockSize =
+      sizeof(T) > sizeof(FreeBlock) ? sizeof(T) : sizeof(FreeBlock);
+  inline static const constexpr size_t kBlockAlignment =
+      alignof(T) > sizeof(void*) ? alignof(T) : sizeof(void*);
+
+  /// A chain of free objects, linked through FreeBlock::next.
+  struct Magazine {
+    FreeBlock* head;
+    uint32_t count;
+  };
+
+  /// A thread's free objects for one pool.
+  struct ThreadCache {
+    /// Pool this cache belongs to; nullptr once the pool was uninitialized.
+    /// Guarded by #caches_mutex_ for writes.
+    EpochPool* owner;
+
+    /// Magazine Allocate() takes from and Recycle() fills.
+    Magazine loaded;
+
+    /// Full or empty magazine swapped in when #loaded runs empty or full.
+    Magazine previous;
+  };
+
+  /// Thread-local set of a thread's caches, one per pool it has used; gives
+  /// their objects to the pools when the thread exits.
+  struct ThreadCaches {
+    std::vector<ThreadCache*> caches;
+    ~ThreadCaches() {
+      std::unique_lock<std::mutex> lock(caches_mutex_);
+      for (ThreadCache* cache : caches) {
+        EpochPool* owner = cache->owner;
+        if (owner) {
+          auto& registered = owner->caches_;
+          registered.erase(
+              std::find(registered.begin(), registered.end(), cache));
+          std::unique_lock<std::mutex> magazines_lock(owner->magazines_mutex_);
+          if (cache->loaded.head) owner->magazines_.push_back(cache->loaded);
+          if (cache->previous.head) {
+            owner->magazines_.push_back(cache->previous);
+          }
+        }
+        delete cache;
+      }
+    }
+  };
+  inline static thread_local ThreadCaches tls_caches_;
+
+  /// Find (or create and register) the calling thread's cache for this pool.
+  ThreadCache* GetThreadCache() {
+    std::vector<ThreadCache*>& caches = tls_caches_.caches;
+    for (ThreadCache* cache : caches) {
+      if (cache->owner == this) return cache;
+    }
+
+    // Drop caches of pools that were uninitialized since; they hold nothing.
+    std::unique_lock<std::mutex> lock(caches_mutex_);
+    auto dead = std::remove_if(caches.begin(), caches.end(),
+                               [](ThreadCache* cache) {
+                                 if (cache->owner) return false;
+                                 delete cache;
+                                 return true;
+                               });
+    caches.erase(dead, caches.end());
+
+    ThreadCache* cache = new ThreadCache{this, Magazine{}, Magazine{}};
+    caches_.push_back(cache);
+    caches.push_back(cache);
+    return cache;
+  }
+
+  /// Put \a object's memory on \a cache. If its loaded magazine is full,
+  /// that one becomes the previous one and a full previous magazine moves to
+  /// the shared list.
+  void Recycle(ThreadCache* cache, T* object) {
+    Magazine& loaded = cache->loaded;
+    if (loaded.count == magazine_size_) {
+      if (cache->previous.count) {
+        std::unique_lock<std::mutex> lock(magazines_mutex_);
+        magazines_.push_back(cache->previous);
+      }
+      cache->previous = loaded;
+      loaded = Magazine{};
+    }
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(object);
+    block->next = loaded.head;
+    loaded.head = block;
+    ++loaded.count;
+  }
+
+  /// Load \a cache, whose loaded magazine is empty, with its previous
+  /// magazine or else a full one from the shared list, if there is one.
+  void Refill(ThreadCache* cache) {
+    if (cache->previous.count) {
+      std::swap(cache->loaded, cache->previous);
+      return;
+    }
+    std::unique_lock<std::mutex> lock(magazines_mutex_);
+    if (magazines_.empty()) return;
+    cache->loaded = magazines_.back();
+    magazines_.pop_back();
+  }
+
+  /// Return every block on the chain starting at \a block to the system.
+  void FreeChain(FreeBlock* block) {
+    while (block) {
+      FreeBlock* next = block->next;
+      free(block);
+      allocated_.fetch_sub(1, std::memory_order_relaxed);
+      block = next;
+    }
+  }
+
+  /// Free objects per magazine, half the per-thread cache size.
+  uint32_t magazine_size_;
+
+  /// Objects taken from the system allocator and not returned yet.
+  std::atomic<uint64_t> allocated_;
+
+  /// Guards ThreadCache::owner and #caches_.
+  inline static std::mutex caches_mutex_;
+
+  /// Caches created by threads for this pool.
+  std::vector<ThreadCache*> caches_;
+
+  /// Magazines handed on by threads.
+  std::mutex magazines_mutex_;
+  std::vector<Magazine> magazines_;
+
+  bool initialized_;
+};
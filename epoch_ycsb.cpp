@@ -0,0 +1,501 @@
+// YCSB-style workloads over the epoch-protected reference structures.
+//
+//   epoch_ycsb [--structures=map,stack,queue] [--workloads=a,b,c,w]
+//              [--dists=uniform,zipfian] [--threads=1,2,4] [--keys=1000000]
+//              [--buckets=262144] [--ring=65536] [--duration-ms=1000]
+//              [--json=FILE|-] [--pool=FILE]
+//
+// Map workloads (YCSB core workloads A-C plus a write-heavy one):
+//   a  50% read, 50% update          b  95% read, 5% update
+//   c  100% read                     w  50% read, 25% insert, 25% remove
+// Stack and queue runs push and pop in equal parts; they ignore workloads
+// and key distributions.
+//
+// Every run executes in a child process of its own, so it starts from a
+// fresh heap, and reports throughput, how much the resident memory grew
+// from before its preload to the end of the run, and the items still
+// waiting on the garbage list. It then checks the structure
+// against the operations that succeeded (e.g. size == preload + inserts -
+// removes) and exits with status 1 if they disagree, so the driver doubles
+// as an integration test of the Push()/IsSafeToReclaim() protocol.
+//
+// In PMEM builds the garbage list lives in a pmemobj pool created at --pool
+// (by default on /dev/shm, a DRAM stand-in) for the duration of each run.
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "epoch_hash_map.h"
+#include "garbage_list.h"
+#include "ms_queue.h"
+#include "treiber_stack.h"
+
+namespace {
+
+struct Options {
+  std::vector<std::string> structures{"map", "stack", "queue"};
+  std::vector<std::string> workloads{"a", "b", "c", "w"};
+  std::vector<std::string> dists{"uniform", "zipfian"};
+  std::vector<uint64_t> threads{1};
+  uint64_t keys = 1000000;
+  uint64_t buckets = 256 * 1024;
+  uint64_t ring = 64 * 1024;
+  uint64_t duration_ms = 1000;
+  std::string json;
+  std::string pool = "/dev/shm/epoch_ycsb.pool";
+};
+
+struct Result {
+  std::string structure;
+  std::string workload;
+  std::string dist;
+  uint64_t threads;
+  uint64_t ops;
+  double seconds;
+  uint64_t rss_growth_bytes;
+  uint64_t garbage_outstanding;
+  bool consistent;
+};
+
+std::vector<std::string> SplitList(const char* list) {
+  std::vector<std::string> items;
+  std::string item;
+  for (const char* c = list;; ++c) {
+    if (*c == ',' || *c == '\0') {
+      if (!item.empty()) items.push_back(item);
+      item.clear();
+      if (*c == '\0') break;
+    } else {
+      item += *c;
+    }
+  }
+  return items;
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = strchr(arg, '=');
+    value = value ? value + 1 : "";
+    if (!strncmp(arg, "--structures=", 13)) {
+      options->structures = SplitList(value);
+    } else if (!strncmp(arg, "--workloads=", 12)) {
+      options->workloads = SplitList(value);
+    } else if (!strncmp(arg, "--dists=", 8)) {
+      options->dists = SplitList(value);
+    } else if (!strncmp(arg, "--threads=", 10)) {
+      options->threads.clear();
+      for (const std::string& item : SplitList(value)) {
+        options->threads.push_back(strtoull(item.c_str(), nullptr, 10));
+      }
+    } else if (!strncmp(arg, "--keys=", 7)) {
+      options->keys = strtoull(value, nullptr, 10);
+    } else if (!strncmp(arg, "--buckets=", 10)) {
+      options->buckets = strtoull(value, nullptr, 10);
+    } else if (!strncmp(arg, "--ring=", 7)) {
+      options->ring = strtoull(value, nullptr, 10);
+    } else if (!strncmp(arg, "--duration-ms=", 14)) {
+      options->duration_ms = strtoull(value, nullptr, 10);
+    } else if (!strncmp(arg, "--json=", 7)) {
+      options->json = value;
+    } else if (!strncmp(arg, "--pool=", 7)) {
+      options->pool = value;
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return false;
+    }
+  }
+  if (!options->keys || !IS_POWER_OF_TWO(options->buckets) ||
+      !IS_POWER_OF_TWO(options->ring)) {
+    fprintf(stderr, "--keys must be positive, --buckets and --ring powers "
+                    "of two\n");
+    return false;
+  }
+  return true;
+}
+
+/// Resident set size of the process in bytes.
+uint64_t ResidentBytes() {
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (!statm) return 0;
+  unsigned long size = 0, resident = 0;
+  if (fscanf(statm, "%lu %lu", &size, &resident) != 2) resident = 0;
+  fclose(statm);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+/// YCSB's zipfian generator (Gray et al., "Quickly generating billion-record
+/// synthetic databases"), over [0, items) with the hottest items scattered
+/// across the key space by hashing.
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t items, double theta = 0.99)
+      : items_{items}, theta_{theta} {
+    zeta_n_ = Zeta(items, theta);
+    double zeta_2 = Zeta(2, theta);
+    alpha_ = 1.0 / (1.0 - theta);
+    eta_ = (1 - std::pow(2.0 / items, 1 - theta)) / (1 - zeta_2 / zeta_n_);
+  }
+
+  /// Next key for a thread whose random state is \a seed.
+  uint64_t Next(uint64_t* seed) const {
+    *seed = Murmur3_64(*seed);
+    double u = (*seed >> 11) * (1.0 / (1ull << 53));
+    double uz = u * zeta_n_;
+    uint64_t rank;
+    if (uz < 1.0) {
+      rank = 0;
+    } else if (uz < 1.0 + std::pow(0.5, theta_)) {
+      rank = 1;
+    } else {
+      rank = (uint64_t)(items_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    }
+    return Murmur3_64(rank + 1) % items_;
+  }
+
+ private:
+  static double Zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; ++i) sum += 1.0 / std::pow(i, theta);
+    return sum;
+  }
+
+  uint64_t items_;
+  double theta_;
+  double zeta_n_;
+  double alpha_;
+  double eta_;
+};
+
+/// Run \a body(thread, &seed) on \a threads workers until the duration
+/// expires; \a body returns the number of operations it performed.
+template <typename Body>
+double RunTimed(const Options& options, uint64_t threads, uint64_t* ops,
+                Body body) {
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> total{0};
+  std::vector<std::thread> workers;
+  auto begin = std::chrono::steady_clock::now();
+  for (uint64_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      uint64_t seed = t + 1;
+      uint64_t count = 0;
+      while (!stop.load(std::memory_order_relaxed)) count += body(t, &seed);
+      total.fetch_add(count);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_ms));
+  stop.store(true);
+  for (std::thread& worker : workers) worker.join();
+  *ops = total.load();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       begin)
+      .count();
+}
+
+/// Run \a run in a child process and return \a result with its
+/// measurements. In one process, memory that earlier runs freed would be
+/// reused by later ones and hide part of their footprint.
+template <typename Run>
+Result RunIsolated(Result result, Run run) {
+  struct Measurements {
+    uint64_t ops;
+    double seconds;
+    uint64_t rss_growth_bytes;
+    uint64_t garbage_outstanding;
+    bool consistent;
+  };
+  void* shared = mmap(nullptr, sizeof(Measurements), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  Measurements* measurements = new (shared) Measurements{};
+  fflush(stdout);
+  pid_t child = fork();
+  if (child < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (child == 0) {
+    Result r = run();
+    *measurements = Measurements{r.ops, r.seconds, r.rss_growth_bytes,
+                                 r.garbage_outstanding, r.consistent};
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+    fprintf(stderr, "%s run did not finish\n", result.structure.c_str());
+    measurements->consistent = false;
+  }
+  result.ops = measurements->ops;
+  result.seconds = measurements->seconds;
+  result.rss_growth_bytes = measurements->rss_growth_bytes;
+  result.garbage_outstanding = measurements->garbage_outstanding;
+  result.consistent = measurements->consistent;
+  munmap(shared, sizeof(Measurements));
+  return result;
+}
+
+const uint64_t kBatch = 256;
+
+/// An EpochManager and a GarbageList on it, set up for one run.
+struct Reclaimer {
+  explicit Reclaimer(const Options& options) {
+    manager.Initialize();
+#ifdef PMEM
+    unlink(options.pool.c_str());
+    size_t pool_size = sizeof(GarbageList::Item) * options.ring * 2;
+    if (pool_size < PMEMOBJ_MIN_POOL) pool_size = PMEMOBJ_MIN_POOL;
+    path = options.pool;
+    pool = pmemobj_create(path.c_str(), POBJ_LAYOUT_NAME(garbagelist),
+                          pool_size, very_pm::CREATE_MODE_RW);
+    if (!pool) {
+      perror(path.c_str());
+      exit(1);
+    }
+    list.Initialize(&manager, pool, options.ring);
+#else
+    list.Initialize(&manager, options.ring);
+#endif
+  }
+  ~Reclaimer() {
+    list.Uninitialize();
+#ifdef PMEM
+    pmemobj_close(pool);
+    unlink(path.c_str());
+#endif
+  }
+
+  EpochManager manager;
+  GarbageList list;
+#ifdef PMEM
+  PMEMobjpool* pool;
+  std::string path;
+#endif
+};
+
+Result RunMap(const Options& options, const std::string& workload,
+              const std::string& dist, uint64_t threads) {
+  uint64_t baseline = ResidentBytes();
+  Reclaimer reclaimer(options);
+  EpochHashMap<uint64_t, uint64_t> map;
+  map.Initialize(&reclaimer.manager, &reclaimer.list, options.buckets);
+
+  // Preload every other key so that inserts and removes both find work.
+  for (uint64_t key = 0; key < options.keys; key += 2) map.Insert(key, key);
+  uint64_t preloaded = map.GetSize();
+
+  uint64_t read_pct = 50, update_pct = 50, insert_pct = 0;
+  if (workload == "b") {
+    read_pct = 95;
+    update_pct = 5;
+  } else if (workload == "c") {
+    read_pct = 100;
+    update_pct = 0;
+  } else if (workload == "w") {
+    read_pct = 50;
+    update_pct = 0;
+    insert_pct = 25;
+  }
+  ZipfianGenerator zipfian(options.keys);
+  bool skewed = dist == "zipfian";
+
+  std::atomic<uint64_t> inserted{0}, removed{0}, bad_reads{0};
+  uint64_t ops = 0;
+  double seconds =
+      RunTimed(options, threads, &ops, [&](uint64_t, uint64_t* seed) {
+        uint64_t local_inserted = 0, local_removed = 0, local_bad = 0;
+        for (uint64_t i = 0; i < kBatch; ++i) {
+          uint64_t key =
+              skewed ? zipfian.Next(seed) : (*seed = Murmur3_64(*seed)) %
+                                                options.keys;
+          uint64_t op = Murmur3_64(*seed ^ i) % 100;
+          uint64_t value;
+          if (op < read_pct) {
+            // Values are only ever set to their key, so anything else was
+            // read from freed memory.
+            if (map.Get(key, &value) && value != key) ++local_bad;
+          } else if (op < read_pct + update_pct) {
+            map.Update(key, key);
+          } else if (op < read_pct + update_pct + insert_pct) {
+            local_inserted += map.Insert(key, key);
+          } else {
+            local_removed += map.Remove(key);
+          }
+        }
+        inserted.fetch_add(local_inserted, std::memory_order_relaxed);
+        removed.fetch_add(local_removed, std::memory_order_relaxed);
+        bad_reads.fetch_add(local_bad, std::memory_order_relaxed);
+        return kBatch;
+      });
+
+  ReclamationStats stats;
+  reclaimer.list.GetStats(&stats);
+  uint64_t rss = ResidentBytes() - baseline;
+
+  // Every key must still be found exactly when the counts say it should.
+  uint64_t found = 0;
+  for (uint64_t key = 0; key < options.keys; ++key) {
+    uint64_t value;
+    if (map.Get(key, &value)) ++found;
+  }
+  bool consistent = !bad_reads.load() &&
+                    found == preloaded + inserted.load() - removed.load() &&
+                    found == map.GetSize();
+  return Result{"map", workload, dist, threads, ops, seconds, rss,
+                stats.outstanding, consistent};
+}
+
+template <typename Structure, typename PushFn, typename PopFn>
+Result RunPushPop(const Options& options, const std::string& name,
+                  uint64_t threads, uint64_t baseline, Structure* structure,
+                  GarbageList* list, PushFn push, PopFn pop) {
+  const uint64_t kPreload = 1024;
+  for (uint64_t i = 0; i < kPreload; ++i) push(structure, i);
+
+  std::atomic<uint64_t> pushed{0}, popped{0};
+  uint64_t ops = 0;
+  double seconds =
+      RunTimed(options, threads, &ops, [&](uint64_t, uint64_t* seed) {
+        uint64_t local_pushed = 0, local_popped = 0;
+        for (uint64_t i = 0; i < kBatch; ++i) {
+          *seed = Murmur3_64(*seed);
+          if (*seed & 1) {
+            push(structure, *seed);
+            ++local_pushed;
+          } else {
+            uint64_t value;
+            local_popped += pop(structure, &value);
+          }
+        }
+        pushed.fetch_add(local_pushed, std::memory_order_relaxed);
+        popped.fetch_add(local_popped, std::memory_order_relaxed);
+        return kBatch;
+      });
+
+  ReclamationStats stats;
+  list->GetStats(&stats);
+  uint64_t rss = ResidentBytes() - baseline;
+
+  uint64_t remaining = 0, value;
+  while (pop(structure, &value)) ++remaining;
+  bool consistent = remaining == kPreload + pushed.load() - popped.load();
+  return Result{name, "-", "-", threads, ops, seconds, rss,
+                stats.outstanding, consistent};
+}
+
+Result RunStack(const Options& options, uint64_t threads) {
+  uint64_t baseline = ResidentBytes();
+  Reclaimer reclaimer(options);
+  TreiberStack<uint64_t> stack;
+  stack.Initialize(&reclaimer.manager, &reclaimer.list);
+  return RunPushPop(
+      options, "stack", threads, baseline, &stack, &reclaimer.list,
+      [](TreiberStack<uint64_t>* s, uint64_t v) { s->Push(v); },
+      [](TreiberStack<uint64_t>* s, uint64_t* v) { return s->Pop(v); });
+}
+
+Result RunQueue(const Options& options, uint64_t threads) {
+  uint64_t baseline = ResidentBytes();
+  Reclaimer reclaimer(options);
+  MSQueue<uint64_t> queue;
+  queue.Initialize(&reclaimer.manager, &reclaimer.list);
+  return RunPushPop(
+      options, "queue", threads, baseline, &queue, &reclaimer.list,
+      [](MSQueue<uint64_t>* q, uint64_t v) { q->Enqueue(v); },
+      [](MSQueue<uint64_t>* q, uint64_t* v) { return q->Dequeue(v); });
+}
+
+void WriteJson(FILE* out, const Options& options,
+               const std::vector<Result>& results) {
+  fprintf(out, "{\n  \"config\": {\"keys\": %lu, \"buckets\": %lu, "
+               "\"ring\": %lu, \"duration_ms\": %lu, \"cpus\": %ld},\n",
+          options.keys, options.buckets, options.ring, options.duration_ms,
+          sysconf(_SC_NPROCESSORS_ONLN));
+  fprintf(out, "  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    fprintf(out,
+            "    {\"structure\": \"%s\", \"workload\": \"%s\", "
+            "\"dist\": \"%s\", \"threads\": %lu, \"ops\": %lu, "
+            "\"seconds\": %.6f, \"mops\": %.3f, \"rss_growth_bytes\": %lu, "
+            "\"garbage_outstanding\": %lu, \"consistent\": %s}%s\n",
+            r.structure.c_str(), r.workload.c_str(), r.dist.c_str(),
+            r.threads, r.ops, r.seconds, r.ops / r.seconds / 1e6,
+            r.rss_growth_bytes, r.garbage_outstanding,
+            r.consistent ? "true" : "false", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) return 1;
+
+  std::vector<Result> results;
+  bool human = options.json != "-";
+  if (human) {
+    printf("%-6s %-8s %-8s %7s %10s %10s %9s %s\n", "struct", "workload",
+           "dist", "threads", "Mops/s", "+RSS MiB", "garbage", "check");
+  }
+  auto report = [&](const Result& r) {
+    results.push_back(r);
+    if (!human) return;
+    printf("%-6s %-8s %-8s %7lu %10.3f %10.1f %9lu %s\n", r.structure.c_str(),
+           r.workload.c_str(), r.dist.c_str(), r.threads,
+           r.ops / r.seconds / 1e6, r.rss_growth_bytes / 1048576.0,
+           r.garbage_outstanding, r.consistent ? "ok" : "FAILED");
+  };
+  for (const std::string& structure : options.structures) {
+    for (uint64_t threads : options.threads) {
+      if (structure == "map") {
+        for (const std::string& workload : options.workloads) {
+          for (const std::string& dist : options.dists) {
+            report(RunIsolated(Result{"map", workload, dist, threads}, [&] {
+              return RunMap(options, workload, dist, threads);
+            }));
+          }
+        }
+      } else if (structure == "stack") {
+        report(RunIsolated(Result{"stack", "-", "-", threads},
+                           [&] { return RunStack(options, threads); }));
+      } else if (structure == "queue") {
+        report(RunIsolated(Result{"queue", "-", "-", threads},
+                           [&] { return RunQueue(options, threads); }));
+      } else {
+        fprintf(stderr, "unknown structure %s\n", structure.c_str());
+        return 1;
+      }
+    }
+  }
+
+  if (!options.json.empty()) {
+    FILE* out = human ? fopen(options.json.c_str(), "w") : stdout;
+    if (!out) {
+      perror(options.json.c_str());
+      return 1;
+    }
+    WriteJson(out, options, results);
+    if (out != stdout) fclose(out);
+  }
+
+  for (const Result& r : results) {
+    if (!r.consistent) return 1;
+  }
+  return 0;
+}
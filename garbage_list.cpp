@@ -1,4 +1,9 @@
 #include "garbage_list.h"
+#include "sharded_garbage_list.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 
 bool IGarbageList::Initialize(EpochManager* epoch_manager, size_t size) {
   (epoch_manager);
@@ -26,7 +31,33 @@ void GarbageList::Item::SetValue(void* removed_item, Epoch epoch,
 #endif
 }
 GarbageList::GarbageList()
-    : epoch_manager_{}, tail_{}, item_count_{}, items_{} {}
+    : sharded_{},
+      epoch_manager_{},
+      tail_{},
+      item_count_{},
+      ring_bits_{},
+      slot_rotation_{},
+#if defined(__AVX512F__) || defined(__AVX2__)
+      vector_sweep_{true},
+#else
+      vector_sweep_{false},
+#endif
+      items_{},
+      reclaimer_running_{false},
+      reclaim_cursor_{},
+      in_flight_sweeps_{},
+      in_flight_ticket_{},
+      scavenge_cursor_{0},
+      max_lag_{},
+      reclaimer_interval_{},
+      reclaimer_stop_{},
+      overflow_head_{nullptr},
+      overflow_segments_{0},
+      max_overflow_segments_{0},
+      overflow_pushers_{0},
+      batch_keys_{},
+      batch_callbacks_{},
+      batch_callback_count_{} {}
 GarbageList::~GarbageList() { Uninitialize(); }
 
 #ifdef PMEM
@@ -68,23 +99,71 @@ bool GarbageList::Initialize(EpochManager* epoch_manager, size_t item_count) {
   for (size_t i = 0; i < item_count; ++i) new (&items_[i]) Item{};
 
   item_count_ = item_count;
+  ring_bits_ = __builtin_ctzll(item_count);
   tail_ = 0;
+  scavenge_cursor_.store(0, std::memory_order_relaxed);
   epoch_manager_ = epoch_manager;
+  SetOverflowLimit(item_count * 4);
+  SetSlotSpread(true);
+  EPOCH_STAT(stats_.Reset());
 
   return true;
 }
 bool GarbageList::Uninitialize() {
   if (!epoch_manager_) return true;
 
-  for (size_t i = 0; i < item_count_; ++i) {
-    Item& item = items_[i];
-    if (item.removed_item) {
-      item.destroy_callback(item.destroy_callback_context, item.removed_item);
-      item.removed_item = nullptr;
-      item.removal_epoch = 0;
+  StopReclaimer();
+
+  // Items still staged in other threads' retire buffers are destroyed along
+  // with the ring; the buffers themselves belong to their threads and are
+  // freed when those exit.
+  DestroyBatch batch;
+  batch.count = 0;
+  {
+    std::unique_lock<std::mutex> lock(retire_buffers_mutex_);
+    for (RetireBuffer* buffer : retire_buffers_) {
+      for (uint32_t i = 0; i < buffer->count; ++i) {
+        AddToBatch(&batch, buffer->items[i]);
+      }
+      buffer->count = 0;
+      buffer->owner = nullptr;
     }
+    retire_buffers_.clear();
+  }
+  // Other threads unhook theirs on their next Unprotect(); hook lists may
+  // only be changed by their own thread.
+  for (RetireBuffer* buffer : tls_retire_buffers_.buffers) {
+    if (!buffer->owner) EpochManager::UnregisterUnprotectHook(buffer);
   }
 
+  for (size_t first = 0; first < item_count_; first += 64) {
+    size_t count = std::min<size_t>(64, item_count_ - first);
+    for (uint64_t mask = SlotMask(first, count, invalid_epoch); mask;
+         mask &= mask - 1) {
+      Item& item = items_[first + __builtin_ctzll(mask)];
+      if (item.removed_item) {
+        AddToBatch(&batch, item);
+        item.removed_item = nullptr;
+        item.removal_epoch = 0;
+      }
+    }
+  }
+  OverflowSegment* segment = overflow_head_.exchange(nullptr);
+  while (segment) {
+    uint32_t used = std::min(segment->used.load(), kOverflowSegmentSize);
+    for (uint32_t i = segment->swept; i < used; ++i) {
+      Item& item = segment->items[i];
+      if (item.removal_epoch != invalid_epoch) AddToBatch(&batch, item);
+    }
+    OverflowSegment* next = segment->next;
+    free(segment);
+    segment = next;
+  }
+  for (OverflowSegment* unlinked : unlinked_segments_) free(unlinked);
+  unlinked_segments_.clear();
+  overflow_segments_ = 0;
+  DestroyItems(&batch);
+
 #ifdef PMEM
   auto oid = pmemobj_oid((char*)items_ - very_pm::kPMDK_PADDING);
   pmemobj_free(&oid);
@@ -99,99 +178,724 @@ bool GarbageList::Uninitialize() {
 
   return true;
 }
+GarbageList::ClaimResult GarbageList::TryClaimSlot(int64_t ticket,
+                                                   int64_t* slot) {
+  *slot = SlotOf(ticket);
+  bool recycle = RecycleInline(ticket);
+
+  // Roll the epoch over when the manager's advance policy says so (by
+  // default every time we work through 25% of the capacity of the list),
+  // and give spilled items a chance to go. A running reclaimer does this on
+  // its own cadence.
+  if (recycle && epoch_manager_->ShouldAdvance(ticket, item_count_)) {
+    epoch_manager_->BumpCurrentEpoch();
+    if (overflow_head_.load(std::memory_order_relaxed)) SweepOverflow(false);
+  }
+
+  Item& item = items_[*slot];
+
+  Epoch priorItemEpoch = item.removal_epoch;
+  if (priorItemEpoch == invalid_epoch) {
+    // Someone is modifying this slot. Try elsewhere.
+    EPOCH_STAT(stats_.Add(kStatPushRetriesBusy));
+    return kClaimBusy;
+  }
+  if (priorItemEpoch && !recycle) {
+    // Occupied; the reclaimer will get to it.
+    EPOCH_STAT(stats_.Add(kStatPushRetriesBusy));
+    return kClaimBusy;
+  }
+
+  // Ensure it is safe to free the old entry before taking the slot. The
+  // cached safe epoch may merely be stale, so ask for a (rate limited)
+  // refresh before trying elsewhere. Safety can only grow, so the verdict
+  // still holds if the CAS below finds the same epoch.
+  if (priorItemEpoch && !epoch_manager_->IsSafeToReclaim(priorItemEpoch) &&
+      !epoch_manager_->RefreshSafeToReclaimEpoch(priorItemEpoch)) {
+    EPOCH_STAT(stats_.Add(kStatPushRetriesUnsafe));
+    return kClaimUnsafe;
+  }
+
+  Epoch result = CompareExchange64<Epoch>(&item.removal_epoch, invalid_epoch,
+                                          priorItemEpoch);
+  if (result != priorItemEpoch) {
+    // Someone else is now modifying the slot or it has been
+    // replaced with a new item. If someone replaces the old item
+    // with a new one of the same epoch number, that's ok.
+    EPOCH_STAT(stats_.Add(kStatPushRetriesBusy));
+    return kClaimBusy;
+  }
+
+  if (priorItemEpoch) {
+    EPOCH_STAT(RecordDestroyed(priorItemEpoch));
+    item.destroy_callback(item.destroy_callback_context, item.removed_item);
+  }
+  return kClaimed;
+}
+void GarbageList::StoreItem(int64_t slot, void* removed_item,
+                            IGarbageList::DestroyCallback callback,
+                            void* context, Epoch removal_epoch) {
+  Item stack_item;
+  stack_item.destroy_callback = callback;
+  stack_item.destroy_callback_context = context;
+  stack_item.removed_item = removed_item;
+  *((volatile Epoch*)&stack_item.removal_epoch) = removal_epoch;
+
+#ifdef PMEM
+  auto value = _mm256_set_epi64x((int64_t)removed_item, (int64_t)context,
+                                 (int64_t)callback, (int64_t)removal_epoch);
+  _mm256_stream_si256((__m256i*)(items_ + slot), value);
+#else
+  items_[slot] = stack_item;
+#endif
+}
+bool GarbageList::PushToRing(void* removed_item,
+                             IGarbageList::DestroyCallback callback,
+                             void* context, Epoch removal_epoch) {
+  uint32_t unsafe = 0;
+  for (;;) {
+    int64_t slot;
+    ClaimResult result = TryClaimSlot(tail_.fetch_add(1), &slot);
+    if (result == kClaimed) {
+      StoreItem(slot, removed_item, callback, context, removal_epoch);
+      EPOCH_STAT(stats_.Add(kStatPushes));
+      return true;
+    }
+    // A run of unsafe slots means the ring is full of items some protected
+    // thread (possibly this one) may still see; more laps won't help.
+    unsafe = result == kClaimUnsafe ? unsafe + 1 : 0;
+    if (unsafe >= kSpillAfterUnsafeSlots) return false;
+  }
+}
+bool GarbageList::PushStamped(void* removed_item,
+                              IGarbageList::DestroyCallback callback,
+                              void* context, Epoch removal_epoch,
+                              bool force) {
+  for (;;) {
+    if (PushToRing(removed_item, callback, context, removal_epoch)) {
+      return true;
+    }
+    if (max_overflow_segments_) {
+      return Spill(removed_item, callback, context, removal_epoch, force);
+    }
+  }
+}
 bool GarbageList::Push(void* removed_item,
                        IGarbageList::DestroyCallback callback, void* context) {
+  return PushStamped(removed_item, callback, context,
+                     epoch_manager_->GetCurrentEpoch());
+}
+bool GarbageList::TryPush(void* removed_item,
+                          IGarbageList::DestroyCallback callback,
+                          void* context) {
+  return PushToRing(removed_item, callback, context,
+                    epoch_manager_->GetCurrentEpoch());
+}
+size_t GarbageList::PushBatch(const Item* items, size_t count) {
+  return PublishBatch(items, count, false);
+}
+size_t GarbageList::PublishBatch(const Item* items, size_t count,
+                                 bool force) {
+  if (!count) return 0;
+
   Epoch removal_epoch = epoch_manager_->GetCurrentEpoch();
 
+  // Never claim more than a quarter of the ring at once so a single batch
+  // cannot lap itself or starve concurrent pushers.
+  size_t max_run = item_count_ >> 2 ? item_count_ >> 2 : 1;
+  for (size_t done = 0; done < count;) {
+    size_t run = count - done < max_run ? count - done : max_run;
+    int64_t first = tail_.fetch_add(run);
+    for (size_t i = 0; i < run; ++i) {
+      const Item& src = items[done + i];
+      int64_t slot;
+      if (TryClaimSlot(first + i, &slot) == kClaimed) {
+        StoreItem(slot, src.removed_item, src.destroy_callback,
+                  src.destroy_callback_context, removal_epoch);
+        EPOCH_STAT(stats_.Add(kStatPushes));
+      } else if (!PushStamped(src.removed_item, src.destroy_callback,
+                              src.destroy_callback_context, removal_epoch,
+                              force)) {
+        // The rest of the run's tickets are skipped like failed claims.
+        return done + i;
+      }
+    }
+    done += run;
+  }
+  return count;
+}
+bool GarbageList::Retire(void* removed_item,
+                         IGarbageList::DestroyCallback callback,
+                         void* context) {
+  RetireBuffer* buffer = GetRetireBuffer();
+  // Destroy callbacks run by the flush in progress may retire again.
+  if (buffer->flushing) {
+    return sharded_ ? sharded_->Push(removed_item, callback, context)
+                    : Push(removed_item, callback, context);
+  }
+  if (buffer->count == kRetireBufferSize) {
+    // Still full of items the last flush could not place; try again.
+    FlushRetireBuffer(buffer);
+    if (buffer->count == kRetireBufferSize) return false;
+  }
+  Item& item = buffer->items[buffer->count++];
+  item.destroy_callback = callback;
+  item.destroy_callback_context = context;
+  item.removed_item = removed_item;
+  if (buffer->count == kRetireBufferSize) FlushRetireBuffer(buffer);
+  return true;
+}
+bool GarbageList::FlushRetireBuffer() {
+  RetireBuffer* buffer = FindRetireBuffer();
+  if (!buffer) return true;
+  FlushRetireBuffer(buffer);
+  return buffer->count == 0;
+}
+void GarbageList::FlushRetireBuffer(RetireBuffer* buffer, bool force) {
+  if (!buffer->count || buffer->flushing) return;
+  buffer->flushing = true;
+  size_t taken =
+      sharded_ ? sharded_->PublishBatch(buffer->items, buffer->count, force)
+               : PublishBatch(buffer->items, buffer->count, force);
+  buffer->flushing = false;
+  buffer->count -= taken;
+  memmove(buffer->items, buffer->items + taken, sizeof(Item) * buffer->count);
+}
+void GarbageList::OnUnprotect(EpochManager::UnprotectHook* hook) {
+  RetireBuffer* buffer = static_cast<RetireBuffer*>(hook);
+  if (buffer->owner) {
+    buffer->owner->FlushRetireBuffer(buffer);
+  } else {
+    // The list was uninitialized; GetRetireBuffer() may reuse the buffer.
+    EpochManager::UnregisterUnprotectHook(buffer);
+  }
+}
+
+thread_local GarbageList::ThreadRetireBuffers GarbageList::tls_retire_buffers_;
+
+GarbageList::RetireBuffer* GarbageList::FindRetireBuffer() {
+  for (RetireBuffer* buffer : tls_retire_buffers_.buffers) {
+    if (buffer->owner == this) return buffer;
+  }
+  return nullptr;
+}
+GarbageList::RetireBuffer* GarbageList::GetRetireBuffer() {
+  RetireBuffer* buffer = FindRetireBuffer();
+  if (buffer) {
+    // The thread gave its table entry back, dropping the hook with it; hook
+    // the buffer into the entry it has now so Unprotect() flushes it again.
+    if (!buffer->table_id) epoch_manager_->RegisterUnprotectHook(buffer);
+    return buffer;
+  }
+
+  // Take over the buffer of a list that was uninitialized, if any, so a
+  // thread that outlives many lists keeps as many buffers as it has live
+  // lists.
+  for (RetireBuffer* unused : tls_retire_buffers_.buffers) {
+    if (!unused->owner) {
+      buffer = unused;
+      break;
+    }
+  }
+  if (buffer) {
+    EpochManager::UnregisterUnprotectHook(buffer);
+    buffer->count = 0;
+    buffer->flushing = false;
+  } else {
+    buffer = new RetireBuffer{};
+    buffer->callback = &GarbageList::OnUnprotect;
+    tls_retire_buffers_.buffers.push_back(buffer);
+  }
+  {
+    std::unique_lock<std::mutex> lock(retire_buffers_mutex_);
+    buffer->owner = this;
+    retire_buffers_.push_back(buffer);
+  }
+  epoch_manager_->RegisterUnprotectHook(buffer);
+  return buffer;
+}
+GarbageList::ThreadRetireBuffers::~ThreadRetireBuffers() {
+  // Flushing runs destroy callbacks, which may retire into (and so add)
+  // buffers; take each one out before touching it.
+  while (!buffers.empty()) {
+    RetireBuffer* buffer = buffers.back();
+    buffers.pop_back();
+    GarbageList* owner = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(retire_buffers_mutex_);
+      owner = buffer->owner;
+      if (owner) {
+        auto& registered = owner->retire_buffers_;
+        registered.erase(
+            std::find(registered.begin(), registered.end(), buffer));
+        buffer->owner = nullptr;
+      }
+    }
+    // Unhook before the buffer goes away: other thread_local destructors
+    // may still Unprotect(). This is a no-op if the EpochManager is gone.
+    EpochManager::UnregisterUnprotectHook(buffer);
+    // Lists that were uninitialized already destroyed whatever was staged
+    // here, so only live owners are touched. Nobody is left to hand items
+    // back to, so these may exceed the overflow limit.
+    if (owner) owner->FlushRetireBuffer(buffer, true);
+    delete buffer;
+  }
+}
+GarbageList::Item* GarbageList::ReserveItem() {
   for (;;) {
-    int64_t slot = (tail_.fetch_add(1) - 1) & (item_count_ - 1);
+    int64_t slot;
+    if (TryClaimSlot(tail_.fetch_add(1), &slot) == kClaimed) {
+      EPOCH_STAT(stats_.Add(kStatPushes));
+      return &items_[slot];
+    }
+  }
+}
+bool GarbageList::RecycleInline(int64_t ticket) {
+  if (!reclaimer_running_.load(std::memory_order_relaxed)) return true;
+  return ticket - reclaim_cursor_.load(std::memory_order_relaxed) > max_lag_;
+}
+bool GarbageList::ReclaimSlot(int64_t slot, DestroyBatch* batch) {
+  Item& item = items_[slot];
+  Epoch priorItemEpoch = item.removal_epoch;
+  if (priorItemEpoch == 0 || priorItemEpoch == invalid_epoch ||
+      !epoch_manager_->IsSafeToReclaim(priorItemEpoch)) {
+    return false;
+  }
 
-    // Everytime we work through 25% of the capacity of the list roll
-    // the epoch over.
-    if (((slot << 2) & (item_count_ - 1)) == 0)
-      epoch_manager_->BumpCurrentEpoch();
+  Epoch result = CompareExchange64<Epoch>(&item.removal_epoch, invalid_epoch,
+                                          priorItemEpoch);
+  if (result != priorItemEpoch) {
+    // Someone else is now modifying the slot.
+    return false;
+  }
+  // The item is ours now; free up the slot before paying for the destroy.
+  Item taken = item;
+  StoreItem(slot, nullptr, nullptr, nullptr, 0);
+  EPOCH_STAT(RecordDestroyed(priorItemEpoch));
+  AddToBatch(batch, taken);
+  return true;
+}
+namespace {
+
+/// Bit i of the result is set if 0 < items[i].removal_epoch <= limit, for
+/// i < count. Subtracting one wraps 0 around to the largest epoch, which
+/// turns both tests into one unsigned comparison.
+uint64_t ScalarSlotMask(const GarbageList::Item* items, size_t count,
+                        Epoch limit) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (items[i].removal_epoch - 1 < limit) mask |= uint64_t{1} << i;
+  }
+  return mask;
+}
 
-    Item& item = items_[slot];
+#if defined(__AVX512F__) || defined(__AVX2__)
+/// ScalarSlotMask() a vector of removal epochs at a time. Every Item is a
+/// 32-byte aligned block with the epoch in its first 8 bytes; the blocks are
+/// loaded whole and the epochs shuffled together, which on most cores beats
+/// gathering them.
+uint64_t VectorSlotMask(const GarbageList::Item* items, size_t count,
+                        Epoch limit) {
+  static_assert(sizeof(GarbageList::Item) == 32 &&
+                    offsetof(GarbageList::Item, removal_epoch) == 0,
+                "kernel assumes the epoch leads a 32-byte Item");
+  uint64_t mask = 0;
+  size_t i = 0;
+#if defined(__AVX512F__)
+  const __m512i one = _mm512_set1_epi64(1);
+  const __m512i bound = _mm512_set1_epi64(limit);
+  // Epochs sit in qwords 0 and 4 of each two-Item line; pick them from a
+  // pair of lines into both halves of a vector and keep the low half of
+  // the first pair and the high half of the second. (Unlike the 256-bit
+  // casts and inserts, none of this starts from an undefined register.)
+  const __m512i pick = _mm512_set_epi64(12, 8, 4, 0, 12, 8, 4, 0);
+  for (; i + 8 <= count; i += 8) {
+    const char* block = reinterpret_cast<const char*>(items + i);
+    __m512i low = _mm512_permutex2var_epi64(
+        _mm512_loadu_si512(block), pick, _mm512_loadu_si512(block + 64));
+    __m512i high = _mm512_permutex2var_epi64(
+        _mm512_loadu_si512(block + 128), pick,
+        _mm512_loadu_si512(block + 192));
+    __m512i epochs = _mm512_mask_blend_epi64(0xf0, low, high);
+    __mmask8 hits =
+        _mm512_cmplt_epu64_mask(_mm512_sub_epi64(epochs, one), bound);
+    mask |= uint64_t{hits} << i;
+  }
+#else
+  // AVX2 only compares signed; flipping the sign bits of both sides gives
+  // the unsigned order.
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i bound = _mm256_set1_epi64x(limit ^ INT64_MIN);
+  for (; i + 4 <= count; i += 4) {
+    const __m256i* block = reinterpret_cast<const __m256i*>(items + i);
+    __m256i first_pair = _mm256_unpacklo_epi64(_mm256_loadu_si256(block),
+                                               _mm256_loadu_si256(block + 1));
+    __m256i second_pair = _mm256_unpacklo_epi64(
+        _mm256_loadu_si256(block + 2), _mm256_loadu_si256(block + 3));
+    __m256i epochs =
+        _mm256_permute2x128_si256(first_pair, second_pair, 0x20);
+    __m256i biased = _mm256_xor_si256(_mm256_sub_epi64(epochs, one), sign);
+    __m256i hits = _mm256_cmpgt_epi64(bound, biased);
+    mask |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(hits))) << i;
+  }
+#endif
+  if (i < count) mask |= ScalarSlotMask(items + i, count - i, limit) << i;
+  return mask;
+}
+#endif
 
-    Epoch priorItemEpoch = item.removal_epoch;
-    if (priorItemEpoch == invalid_epoch) {
-      // Someone is modifying this slot. Try elsewhere.
+}  // namespace
+
+uint64_t GarbageList::SlotMask(size_t first, size_t count, Epoch limit) {
+  assert(count <= 64 && first + count <= item_count_);
+#if defined(__AVX512F__) || defined(__AVX2__)
+  if (vector_sweep_) return VectorSlotMask(items_ + first, count, limit);
+#endif
+  return ScalarSlotMask(items_ + first, count, limit);
+}
+bool GarbageList::SetVectorSweep(bool vector) {
+#if !defined(__AVX512F__) && !defined(__AVX2__)
+  if (vector) return false;
+#endif
+  vector_sweep_ = vector;
+  return true;
+}
+void GarbageList::AddToBatch(DestroyBatch* batch, const Item& item) {
+  if (batch->count == kDestroyBatchSize) DestroyItems(batch);
+  batch->items[batch->count++] = item;
+}
+void GarbageList::DestroyItems(DestroyBatch* batch) {
+  void* objects[kDestroyBatchSize];
+  size_t count = batch->count;
+  batch->count = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    Item& first = batch->items[i];
+    if (!first.destroy_callback) continue;
+
+    BatchDestroyCallback batch_callback = nullptr;
+    for (size_t k = 0; k < batch_callback_count_; ++k) {
+      if (batch_keys_[k] == first.destroy_callback) {
+        batch_callback = batch_callbacks_[k];
+        break;
+      }
+    }
+    if (!batch_callback) {
+      first.destroy_callback(first.destroy_callback_context,
+                             first.removed_item);
       continue;
     }
 
-    Epoch result = CompareExchange64<Epoch>(&item.removal_epoch, invalid_epoch,
-                                            priorItemEpoch);
-    if (result != priorItemEpoch) {
-      // Someone else is now modifying the slot or it has been
-      // replaced with a new item. If someone replaces the old item
-      // with a new one of the same epoch number, that's ok.
+    // Gather the rest of this (callback, context) group; members already
+    // handed out get their callback cleared so later passes skip them.
+    size_t grouped = 0;
+    for (size_t j = i; j < count; ++j) {
+      Item& item = batch->items[j];
+      if (item.destroy_callback == first.destroy_callback &&
+          item.destroy_callback_context == first.destroy_callback_context) {
+        objects[grouped++] = item.removed_item;
+        if (j != i) item.destroy_callback = nullptr;
+      }
+    }
+    batch_callback(first.destroy_callback_context, objects, grouped);
+  }
+}
+bool GarbageList::SetOverflowLimit(size_t max_items) {
+  max_overflow_segments_ =
+      (max_items + kOverflowSegmentSize - 1) / kOverflowSegmentSize;
+  return true;
+}
+bool GarbageList::SetSlotSpread(bool spread) {
+  if (tail_.load(std::memory_order_relaxed)) return false;
+  // One bit more than a line's worth keeps neighbouring tickets out of the
+  // same 128-byte prefetch pair; a ring that fits in two lines has nothing
+  // to spread over.
+  uint32_t rotation = __builtin_ctzll(kItemsPerLine) + 1;
+  slot_rotation_ = spread && ring_bits_ > rotation ? rotation : 0;
+  return true;
+}
+bool GarbageList::Spill(void* removed_item,
+                        IGarbageList::DestroyCallback callback, void* context,
+                        Epoch removal_epoch, bool force) {
+  // Announce ourselves before looking at any segment; see SweepOverflow().
+  overflow_pushers_.fetch_add(1);
+  bool spilled = false;
+  for (;;) {
+    OverflowSegment* head = overflow_head_.load();
+    if (head) {
+      uint32_t index = head->used.fetch_add(1, std::memory_order_relaxed);
+      if (index < kOverflowSegmentSize) {
+        Item& item = head->items[index];
+        item.destroy_callback = callback;
+        item.destroy_callback_context = context;
+        item.removed_item = removed_item;
+        __atomic_store_n(&item.removal_epoch, removal_epoch, __ATOMIC_RELEASE);
+        spilled = true;
+        break;
+      }
+    }
+
+    // The newest segment is full (or there is none); add one if allowed.
+    size_t segments = overflow_segments_.load(std::memory_order_relaxed);
+    if (segments >= max_overflow_segments_ && !force) break;
+    if (!overflow_segments_.compare_exchange_weak(segments, segments + 1)) {
       continue;
     }
+    OverflowSegment* segment = nullptr;
+    if (posix_memalign((void**)&segment, very_pm::kCacheLineSize,
+                       sizeof(OverflowSegment))) {
+      overflow_segments_.fetch_sub(1);
+      break;
+    }
+    memset((void*)segment, 0, sizeof(OverflowSegment));
+    new (&segment->used) std::atomic<uint32_t>{1};
+    segment->next = head;
+    Item& item = segment->items[0];
+    item.destroy_callback = callback;
+    item.destroy_callback_context = context;
+    item.removed_item = removed_item;
+    item.removal_epoch = removal_epoch;
+    if (overflow_head_.compare_exchange_strong(head, segment)) {
+      spilled = true;
+      break;
+    }
+    // Someone else added a segment first; use theirs.
+    free(segment);
+    overflow_segments_.fetch_sub(1);
+  }
+  overflow_pushers_.fetch_sub(1);
+  EPOCH_STAT(if (spilled) stats_.Add(kStatSpills));
+  return spilled;
+}
+size_t GarbageList::SweepOverflow(bool wait, size_t* destroyed) {
+  std::unique_lock<std::mutex> lock(overflow_mutex_, std::defer_lock);
+  if (wait) {
+    lock.lock();
+  } else if (!lock.try_lock()) {
+    return SIZE_MAX;
+  }
 
-    // Ensure it is safe to free the old entry.
-    if (priorItemEpoch) {
-      if (!epoch_manager_->IsSafeToReclaim(priorItemEpoch)) {
-        // Uh-oh, we couldn't free the old entry. Things aren't looking
-        // good, but maybe it was just the result of a race. Replace the
-        // epoch number we mangled and try elsewhere.
-        *((volatile Epoch*)&item.removal_epoch) = priorItemEpoch;
+  // Collect first and destroy after unlocking: destroy callbacks may push
+  // (and so spill and sweep) again.
+  std::vector<Item> taken;
+  size_t remaining = 0;
+  OverflowSegment* prev = nullptr;
+  OverflowSegment* segment = overflow_head_.load();
+  while (segment) {
+    OverflowSegment* next = segment->next;
+    uint32_t used = segment->used.load(std::memory_order_acquire);
+    bool full = used >= kOverflowSegmentSize;
+    if (full) used = kOverflowSegmentSize;
+    for (uint32_t i = segment->swept; i < used; ++i) {
+      Item& item = segment->items[i];
+      Epoch epoch = __atomic_load_n(&item.removal_epoch, __ATOMIC_ACQUIRE);
+      if (epoch == invalid_epoch) continue;
+      // 0: the pusher that got this slot has not stored its item yet.
+      if (epoch == 0 || !epoch_manager_->IsSafeToReclaim(epoch)) {
+        ++remaining;
         continue;
       }
-      item.destroy_callback(item.destroy_callback_context, item.removed_item);
+      EPOCH_STAT(RecordDestroyed(epoch));
+      taken.push_back(item);
+      item.removal_epoch = invalid_epoch;
+    }
+    while (segment->swept < used &&
+           segment->items[segment->swept].removal_epoch == invalid_epoch) {
+      ++segment->swept;
     }
 
-    Item stack_item;
-    stack_item.destroy_callback = callback;
-    stack_item.destroy_callback_context = context;
-    stack_item.removed_item = removed_item;
-    *((volatile Epoch*)&stack_item.removal_epoch) = removal_epoch;
+    // Pushers only ever look at the newest segment, so older ones can be
+    // unlinked directly; the newest one only if no pusher replaced it.
+    bool unlinked = false;
+    if (full && segment->swept == kOverflowSegmentSize) {
+      if (prev) {
+        prev->next = next;
+        unlinked = true;
+      } else {
+        OverflowSegment* expected = segment;
+        unlinked = overflow_head_.compare_exchange_strong(expected, next);
+      }
+    }
+    if (unlinked) {
+      unlinked_segments_.push_back(segment);
+      overflow_segments_.fetch_sub(1);
+    } else {
+      prev = segment;
+    }
+    segment = next;
+  }
 
-#ifdef PMEM
-    auto value = _mm256_set_epi64x((int64_t)removed_item, (int64_t)context,
-                                   (int64_t)callback, (int64_t)removal_epoch);
-    _mm256_stream_si256((__m256i*)(items_ + slot), value);
-#else
-    items_[slot] = stack_item;
-#endif
-    return true;
+  // A pusher may still hold a segment it found at the head before it was
+  // unlinked; once none is spilling, none can.
+  if (!unlinked_segments_.empty() && overflow_pushers_.load() == 0) {
+    for (OverflowSegment* unlinked : unlinked_segments_) free(unlinked);
+    unlinked_segments_.clear();
   }
+  lock.unlock();
+  if (destroyed) *destroyed += taken.size();
+
+  DestroyBatch batch;
+  batch.count = 0;
+  for (const Item& item : taken) AddToBatch(&batch, item);
+  DestroyItems(&batch);
+  return remaining;
 }
-GarbageList::Item* GarbageList::ReserveItem() {
-  Epoch removal_epoch = epoch_manager_->GetCurrentEpoch();
-  for (;;) {
-    int64_t slot = (tail_.fetch_add(1) - 1) & (item_count_ - 1);
-
-    // Everytime we work through 25% of the capacity of the list roll
-    // the epoch over.
-    if (((slot << 2) & (item_count_ - 1)) == 0)
-      epoch_manager_->BumpCurrentEpoch();
-
-    Item& item = items_[slot];
-    Epoch priorItemEpoch = item.removal_epoch;
-
-    Epoch result = CompareExchange64<Epoch>(&item.removal_epoch, invalid_epoch,
-                                            priorItemEpoch);
-    if (result != priorItemEpoch) {
-      // Someone else is now modifying the slot or it has been
-      // replaced with a new item. If someone replaces the old item
-      // with a new one of the same epoch number, that's ok.
+bool GarbageList::RegisterBatchDestroyCallback(
+    DestroyCallback callback, BatchDestroyCallback batch_callback) {
+  if (batch_callback_count_ == kMaxBatchDestroyCallbacks) return false;
+  batch_keys_[batch_callback_count_] = callback;
+  batch_callbacks_[batch_callback_count_] = batch_callback;
+  ++batch_callback_count_;
+  return true;
+}
+void GarbageList::SweepFromCursor() {
+  int64_t end = tail_.load(std::memory_order_acquire);
+  int64_t cursor = reclaim_cursor_.load(std::memory_order_relaxed);
+  // Pushers lapped us; older tickets' slots were recycled inline already.
+  if (end - cursor > (int64_t)item_count_) cursor = end - item_count_;
+
+  DestroyBatch batch;
+  batch.count = 0;
+  for (; cursor < end; ++cursor) {
+    int64_t slot = SlotOf(cursor);
+    Epoch epoch = items_[slot].removal_epoch;
+    // Items mostly arrive in epoch order, so the first one that is not safe
+    // yet means the rest of the range is not either. Slots still being
+    // filled are waited for too, or only a lapping pusher would ever
+    // reclaim them; unless they keep being in flight, which means they were
+    // reserved and may stay that way.
+    if (epoch == 0) continue;
+    if (epoch == invalid_epoch) {
+      if (cursor != in_flight_ticket_) {
+        in_flight_ticket_ = cursor;
+        in_flight_sweeps_ = 0;
+      }
+      if (++in_flight_sweeps_ < kMaxInFlightSweeps) break;
       continue;
     }
+    if (!epoch_manager_->IsSafeToReclaim(epoch)) break;
+    ReclaimSlot(slot, &batch);
+  }
+  reclaim_cursor_.store(cursor, std::memory_order_release);
+  DestroyItems(&batch);
+}
+void GarbageList::ReclaimerLoop() {
+  std::unique_lock<std::mutex> lock(reclaimer_mutex_);
+  while (!reclaimer_stop_) {
+    reclaimer_cv_.wait_for(lock, reclaimer_interval_);
+    if (reclaimer_stop_) break;
+    lock.unlock();
+    epoch_manager_->BumpCurrentEpoch();
+    Reclaim();
+    lock.lock();
+  }
+}
+void GarbageList::Reclaim() {
+  SweepFromCursor();
+  if (overflow_head_.load(std::memory_order_relaxed)) SweepOverflow(false);
+}
+void GarbageList::AttachReclaimer(uint64_t max_lag) {
+  max_lag_ = max_lag ? max_lag : item_count_ / 2;
+  reclaim_cursor_.store(tail_.load(std::memory_order_acquire),
+                        std::memory_order_relaxed);
+  reclaimer_running_.store(true, std::memory_order_release);
+}
+void GarbageList::DetachReclaimer() {
+  reclaimer_running_.store(false, std::memory_order_release);
+}
+bool GarbageList::StartReclaimer(std::chrono::microseconds interval,
+                                 uint64_t max_lag) {
+  if (!epoch_manager_ || reclaimer_.joinable()) return false;
+
+  reclaimer_interval_ = interval;
+  reclaimer_stop_ = false;
+  AttachReclaimer(max_lag);
+  reclaimer_ = std::thread(&GarbageList::ReclaimerLoop, this);
+  return true;
+}
+bool GarbageList::StopReclaimer() {
+  if (!reclaimer_.joinable()) return false;
 
-    // Ensure it is safe to free the old entry.
-    if (priorItemEpoch) {
-      if (!epoch_manager_->IsSafeToReclaim(priorItemEpoch)) {
-        // Uh-oh, we couldn't free the old entry. Things aren't looking
-        // good, but maybe it was just the result of a race. Replace the
-        // epoch number we mangled and try elsewhere.
-        *((volatile Epoch*)&item.removal_epoch) = priorItemEpoch;
-        continue;
+  DetachReclaimer();
+  {
+    std::unique_lock<std::mutex> lock(reclaimer_mutex_);
+    reclaimer_stop_ = true;
+  }
+  reclaimer_cv_.notify_one();
+  reclaimer_.join();
+  return true;
+}
+bool GarbageList::Drain(std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  DestroyBatch batch;
+  batch.count = 0;
+  for (;;) {
+    epoch_manager_->BumpCurrentEpoch();
+    bool empty = true;
+    for (size_t slot = 0; slot < item_count_; ++slot) {
+      // Slots reserved through ReserveItem() (or being filled) belong to
+      // their users, not to the list.
+      ReclaimSlot(slot, &batch);
+      Epoch epoch = items_[slot].removal_epoch;
+      if (epoch != 0 && epoch != invalid_epoch) empty = false;
+    }
+    DestroyItems(&batch);
+    if (SweepOverflow(true)) empty = false;
+    if (empty) return true;
+    if (std::chrono::steady_clock::now() >= deadline) return false;
+    std::this_thread::yield();
+  }
+}
+void GarbageList::GetStats(ReclamationStats* stats) {
+  if (!epoch_manager_) {
+    *stats = ReclamationStats{};
+    return;
+  }
+  epoch_manager_->GetStats(stats);
+  for (size_t slot = 0; slot < item_count_; ++slot) {
+    Epoch epoch = items_[slot].removal_epoch;
+    if (epoch != 0 && epoch != invalid_epoch) ++stats->outstanding;
+  }
+  {
+    std::unique_lock<std::mutex> lock(overflow_mutex_);
+    for (OverflowSegment* segment = overflow_head_.load(); segment;
+         segment = segment->next) {
+      uint32_t used =
+          std::min(segment->used.load(std::memory_order_acquire),
+                   kOverflowSegmentSize);
+      for (uint32_t i = segment->swept; i < used; ++i) {
+        Epoch epoch = __atomic_load_n(&segment->items[i].removal_epoch,
+                                      __ATOMIC_ACQUIRE);
+        if (epoch != 0 && epoch != invalid_epoch) ++stats->outstanding;
       }
-      item.destroy_callback(item.destroy_callback_context, item.removed_item);
     }
-    return &item;
+  }
+  stats->overflow_segments = overflow_segments_.load();
+#ifdef EPOCH_STATS
+  stats->pushes = stats_.Sum(kStatPushes);
+  stats->push_retries_unsafe = stats_.Sum(kStatPushRetriesUnsafe);
+  stats->push_retries_busy = stats_.Sum(kStatPushRetriesBusy);
+  stats->items_destroyed = stats_.Sum(kStatItemsDestroyed);
+  stats->spills = stats_.Sum(kStatSpills);
+  for (size_t i = 0; i < ReclamationStats::kHistogramBuckets; ++i) {
+    stats->latency_epochs[i] = stats_.Sum(kStatLatencyEpochs + i);
+    stats->latency_ns[i] = stats_.Sum(kStatLatencyNs + i);
+  }
+#endif
+}
+#ifdef EPOCH_STATS
+void GarbageList::RecordDestroyed(Epoch removal_epoch) {
+  stats_.Add(kStatItemsDestroyed);
+  Epoch current = epoch_manager_->GetCurrentEpoch();
+  stats_.Add(kStatLatencyEpochs + StatBucket(current - removal_epoch));
+  uint64_t start = epoch_manager_->GetEpochStartTime(removal_epoch);
+  if (start) {
+    uint64_t now = StatNanoseconds();
+    stats_.Add(kStatLatencyNs + StatBucket(now > start ? now - start : 0));
   }
 }
+#endif
 bool GarbageList::ResetItem(GarbageList::Item* item) {
   auto old_epoch = item->removal_epoch;
   assert(old_epoch == invalid_epoch);
@@ -204,12 +908,20 @@ bool GarbageList::ResetItem(GarbageList::Item* item) {
 bool GarbageList::Recovery(EpochManager* epoch_manager,
                            PMEMobjpool* pmdk_pool) {
   uint32_t reclaimed{0};
-  for (size_t i = 0; i < item_count_; ++i) {
-    Item& item = items_[i];
-    if (item.removed_item != nullptr) {
-      item.destroy_callback(item.destroy_callback_context, item.removed_item);
-      new (&items_[i]) Item{};
-      reclaimed += 1;
+  // Items are written whole, epoch included, so every slot that still holds
+  // an item has a non-zero epoch; only those need a look.
+  for (size_t first = 0; first < item_count_; first += 64) {
+    size_t count = std::min<size_t>(64, item_count_ - first);
+    for (uint64_t mask = SlotMask(first, count, invalid_epoch); mask;
+         mask &= mask - 1) {
+      size_t i = first + __builtin_ctzll(mask);
+      Item& item = items_[i];
+      if (item.removed_item != nullptr) {
+        item.destroy_callback(item.destroy_callback_context,
+                              item.removed_item);
+        new (&items_[i]) Item{};
+        reclaimed += 1;
+      }
     }
   }
 #ifdef TEST_BUILD
@@ -221,54 +933,56 @@ bool GarbageList::Recovery(EpochManager* epoch_manager,
   pmdk_pool_ = pmdk_pool;
   return true;
 }
-int32_t GarbageList::Scavenge() {
-  auto max_slot = tail_.load(std::memory_order_relaxed);
-  int32_t scavenged = 0;
-
-  for (int64_t slot = 0; slot < item_count_; ++slot) {
-    auto& item = items_[slot];
-    Epoch priorItemEpoch = item.removal_epoch;
-    if (priorItemEpoch == 0 || priorItemEpoch == invalid_epoch) {
-      // Someone is modifying this slot. Try elsewhere.
-      continue;
+#endif
+int32_t GarbageList::Scavenge(size_t max_slots,
+                              std::chrono::nanoseconds budget) {
+  if (!max_slots) max_slots = item_count_;
+  // Both are powers of two, so a chunk never wraps around the ring.
+  size_t chunk = std::min(kScavengeChunk, item_count_);
+  auto deadline = std::chrono::steady_clock::now() + budget;
+
+  DestroyBatch batch;
+  batch.count = 0;
+  size_t scavenged = 0;
+  bool lapped = false;
+  for (size_t examined = 0; examined < max_slots; examined += chunk) {
+    size_t first =
+        scavenge_cursor_.fetch_add(chunk, std::memory_order_relaxed) &
+        (item_count_ - 1);
+    // Only slots whose epoch looked safe are worth a CAS; ReclaimSlot()
+    // checks again.
+    Epoch safe = epoch_manager_->GetSafeToReclaimEpoch();
+    for (uint64_t mask = SlotMask(first, chunk, safe); mask;
+         mask &= mask - 1) {
+      if (ReclaimSlot(first + __builtin_ctzll(mask), &batch)) ++scavenged;
     }
+    if (first + chunk == item_count_) lapped = true;
+    if (budget.count() && std::chrono::steady_clock::now() >= deadline) break;
+  }
+  DestroyItems(&batch);
+  if (lapped && overflow_head_.load(std::memory_order_relaxed)) {
+    SweepOverflow(false, &scavenged);
+  }
+  return scavenged;
+}
+EpochManager* GarbageList::GetEpoch() { return epoch_manager_; }
 
-    Epoch result = CompareExchange64<Epoch>(&item.removal_epoch, invalid_epoch,
-                                            priorItemEpoch);
-    if (result != priorItemEpoch) {
-      // Someone else is now modifying the slot or it has been
-      // replaced with a new item. If someone replaces the old item
-      // with a new one of the same epoch number, that's ok.
-      continue;
-    }
+thread_local std::vector<PendingRetires::Pending>
+    PendingRetires::tls_leftovers_;
 
-    if (priorItemEpoch) {
-      if (!epoch_manager_->IsSafeToReclaim(priorItemEpoch)) {
-        // Uh-oh, we couldn't free the old entry. Things aren't looking
-        // good, but maybe it was just the result of a race. Replace the
-        // epoch number we mangled and try elsewhere.
-        *((volatile Epoch*)&item.removal_epoch) = priorItemEpoch;
-        continue;
-      }
-      item.destroy_callback(item.destroy_callback_context, item.removed_item);
+void PendingRetires::PushAll() {
+  if (garbage_list_->GetEpoch()->IsProtected()) {
+    tls_leftovers_.insert(tls_leftovers_.end(), items_.begin(), items_.end());
+    tls_leftover_count_ = tls_leftovers_.size();
+    return;
+  }
+  items_.insert(items_.end(), tls_leftovers_.begin(), tls_leftovers_.end());
+  tls_leftovers_.clear();
+  tls_leftover_count_ = 0;
+  for (const Pending& pending : items_) {
+    while (!pending.garbage_list->Push(pending.removed_item, pending.callback,
+                                       pending.context)) {
+      std::this_thread::yield();
     }
-
-    // Now reset the entry
-    Item stack_item;
-    stack_item.destroy_callback = nullptr;
-    stack_item.destroy_callback_context = nullptr;
-    stack_item.removed_item = nullptr;
-    *((volatile Epoch*)&stack_item.removal_epoch) = 0;
-#ifdef PMEM
-    auto value =
-        _mm256_set_epi64x((int64_t)0, (int64_t)0, (int64_t)0, (int64_t)0);
-    _mm256_stream_si256((__m256i*)(items_ + slot), value);
-#else
-    items_[slot] = stack_item;
-#endif
   }
-
-  return scavenged;
 }
-EpochManager* GarbageList::GetEpoch() { return epoch_manager_; }
-#endif
@@ -1,6 +1,11 @@
 #pragma once
 #include <x86intrin.h>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "epoch_manager.h"
 #ifdef PMEM
 #include <libpmemobj.h>
@@ -9,6 +14,8 @@ POBJ_LAYOUT_TOID(garbagelist, char)
 POBJ_LAYOUT_END(garbagelist)
 #endif
 
+class ShardedGarbageList;
+
 /// Interface for the GarbageList; used to make it easy to drop is mocked out
 /// garbage lists for unit testing. See GarbageList template below for
 /// full documentation.
@@ -16,6 +23,11 @@ class IGarbageList {
  public:
   typedef void (*DestroyCallback)(void* callback_context, void* object);
 
+  /// Destroys \a count objects at once, e.g. by handing them to an
+  /// allocator's bulk free. See GarbageList::RegisterBatchDestroyCallback().
+  typedef void (*BatchDestroyCallback)(void* callback_context, void** objects,
+                                       size_t count);
+
   IGarbageList() =default;
 
   virtual ~IGarbageList() =default;
@@ -87,6 +99,57 @@ class GarbageList : public IGarbageList {
   static_assert(std::is_pod<Item>::value, "Item should be POD");
   inline static const constexpr uint64_t invalid_epoch = ~0llu;
 
+  /// Most items a sweep collects before destroying them as a batch.
+  inline static const constexpr size_t kDestroyBatchSize = 64;
+
+  /// Most per-item callbacks that can have a batch counterpart registered.
+  inline static const constexpr size_t kMaxBatchDestroyCallbacks = 8;
+
+  /// A slot the reclaimer found being filled in this many sweeps in a row
+  /// is taken to be held through ReserveItem() and stepped over.
+  inline static const constexpr uint32_t kMaxInFlightSweeps = 8;
+
+  /// Slots Scavenge() claims and examines at a time.
+  inline static const constexpr size_t kScavengeChunk = 64;
+
+  /// Ring slots per cacheline; see SetSlotSpread().
+  inline static const constexpr size_t kItemsPerLine =
+      very_pm::kCacheLineSize / sizeof(Item);
+
+  /// Number of items a thread stages locally in Retire() before publishing
+  /// them into the ring with a single PushBatch().
+  inline static const constexpr uint32_t kRetireBufferSize = 32;
+
+  /// Items per overflow segment; see SetOverflowLimit().
+  inline static const constexpr uint32_t kOverflowSegmentSize = 1024;
+
+  /// A pusher spills into the overflow once this many ring slots in a row
+  /// held items that were not safe to reclaim yet.
+  inline static const constexpr uint32_t kSpillAfterUnsafeSlots = 64;
+
+  /// Per-thread, per-list staging area used by Retire(). Items are kept here
+  /// unstamped and are published with one tail_ increment and one epoch read
+  /// when the buffer fills up, when the thread calls Unprotect() on the
+  /// list's EpochManager, or on FlushRetireBuffer(). Stamping at publish time
+  /// is safe since the epoch read then can only be later than the removal.
+  struct RetireBuffer : public EpochManager::UnprotectHook {
+    /// List the items will be published to; nullptr once that list has
+    /// been uninitialized, after which the owning thread unhooks the buffer
+    /// on its next Unprotect() and hands it to the next list it retires
+    /// into. Guarded by #retire_buffers_mutex_ for writes.
+    GarbageList* owner;
+
+    /// Number of valid entries in #items.
+    uint32_t count;
+
+    /// Set while the buffer is being published; items retired meanwhile
+    /// (by destroy callbacks) bypass it.
+    bool flushing;
+
+    /// Staged items; their removal_epoch is ignored until publication.
+    Item items[kRetireBufferSize];
+  };
+
   /// Construct a GarbageList in an uninitialized state.
   GarbageList();
 
@@ -103,8 +166,10 @@ class GarbageList : public IGarbageList {
   ///      items pushed onto the list. Must not be nullptr.
   /// \param nItems
   ///      Number of addresses that can be held aside for pointer stability.
-  ///      If this number is too small the system runs the risk of deadlock.
-  ///      Must be a power of two.
+  ///      If this number is too small for the garbage retired while some
+  ///      thread stays protected, pushers spill into overflow segments (see
+  ///      SetOverflowLimit()) and fail once those are used up. Must be a
+  ///      power of two.
   ///
   /// \retval S_OK
   ///      The instance is now initialized and ready for use.
@@ -157,12 +222,96 @@ class GarbageList : public IGarbageList {
   ///      \a destroyCallback; it threads state to destroyCallback calls so
   ///      they can access, for example, the allocator from which the object
   ///      was allocated. Left uninterpreted, so may be nullptr.
+  ///
+  /// \retval false No ring slot could be recycled and the overflow is at
+  ///      its limit (see SetOverflowLimit()); the item was not taken and
+  ///      still belongs to the caller.
   virtual bool Push(void* removed_item, DestroyCallback callback,
                     void* context);
 
+  /// Push() that only uses the ring: gives up and returns false after
+  /// kSpillAfterUnsafeSlots unsafe slots in a row, where Push() would spill,
+  /// so a caller with several lists can try another one first.
+  bool TryPush(void* removed_item, DestroyCallback callback, void* context);
+
+  /// Append \a count items to the reclamation queue at once. All of them are
+  /// stamped with a single read of the current epoch, and their ring slots
+  /// are claimed with one increment of #tail_, so concurrent retirers contend
+  /// on the tail once per batch rather than once per item. The removal_epoch
+  /// field of the passed items is ignored. Slots that turn out to be busy or
+  /// not yet safe to recycle fall back to the regular Push() loop.
+  ///
+  /// \return The number of items taken, which are the first ones of
+  ///      \a items; fewer than \a count only if Push() would have failed.
+  size_t PushBatch(const Item* items, size_t count);
+
+  /// Stage an item in the calling thread's retire buffer for this list; see
+  /// RetireBuffer for when buffered items are published. Takes the same
+  /// arguments as Push(). Items stay in the buffer (and so unreclaimed) until
+  /// published, so threads that retire outside of a protected region should
+  /// call FlushRetireBuffer() once they are done.
+  ///
+  /// Items the ring and the overflow could not take stay in the buffer for
+  /// the next flush; once it is full of them this returns false and leaves
+  /// \a removed_item with the caller.
+  bool Retire(void* removed_item, DestroyCallback callback, void* context);
+
+  /// Publish everything the calling thread has staged with Retire().
+  /// \retval false Some items could not be taken and are still staged.
+  bool FlushRetireBuffer();
+
+  /// Let pushers that find no recyclable slot in the ring (because every
+  /// item they try is newer than some protected thread) spill up to
+  /// \a max_items items into overflow segments instead of spinning until
+  /// readers move on. Segments hold kOverflowSegmentSize items each, live in
+  /// DRAM in all builds (so Recovery() does not see spilled items) and are
+  /// allocated as needed, up to the first whole segment at or above
+  /// \a max_items. Pushes beyond that fail. Spilled items are destroyed by
+  /// the list's sweeps once safe (the pushers' epoch bumps, the reclaimer,
+  /// Drain() and Scavenge()) and drained segments are freed again, shrinking
+  /// the list back to its ring. 0 disables spilling; pushers then spin as
+  /// before. Defaults to four times the ring.
+  bool SetOverflowLimit(size_t max_items);
+
+  /// Choose how tickets (successive tail_ values) map to ring slots. Spread
+  /// (the default) rotates the slot index left by log2(kItemsPerLine) + 1
+  /// bits, so that ticket t goes to slot 2 * kItemsPerLine * (t - 1) mod
+  /// ring size, plus the bits rotated out: consecutive tickets land two
+  /// cachelines apart, outside the 128-byte pairs that adjacent-line
+  /// prefetchers fetch together, and concurrent pushers don't invalidate
+  /// each other's lines when they claim and fill neighbouring tickets.
+  /// Tickets ring size / (2 * kItemsPerLine) apart share a line. Packed maps
+  /// ticket t to slot t - 1 mod ring size, so sweeps walk the ring
+  /// sequentially. Either way a lap of the ring visits every slot once. Call
+  /// after Initialize().
+  ///
+  /// \retval false Items were pushed already; the mapping can only be
+  ///      changed on an empty list.
+  bool SetSlotSpread(bool spread);
+
+  /// Have Scavenge(), Uninitialize() and Recovery() find occupied slots by
+  /// comparing removal epochs a vector register at a time (the default
+  /// where the build targets AVX2 or AVX-512), or one slot at a time.
+  ///
+  /// \retval false \a vector was requested but the build has no vector
+  ///      kernel.
+  bool SetVectorSweep(bool vector);
+
+  /// Have sweeps (the background reclaimer, Drain() and Uninitialize())
+  /// destroy items that were pushed with \a callback by grouping them per
+  /// context and passing each group to \a batch_callback in one call, rather
+  /// than calling \a callback once per item. Pushers that recycle a single
+  /// slot inline still use \a callback, so both must be equivalent. Must be
+  /// called before any item with \a callback is pushed.
+  ///
+  /// \retval false Already kMaxBatchDestroyCallbacks are registered.
+  bool RegisterBatchDestroyCallback(DestroyCallback callback,
+                                    BatchDestroyCallback batch_callback);
+
   /// Used to reserve a place for (persistent memory) allocators that requires a
   /// pre-existing memory location. The corresponding removal_epoch will be
-  /// marked as invalid epoch.
+  /// marked as invalid epoch. Reserved items must be in the ring, so this
+  /// never spills and keeps trying slots until one is free.
   Item* ReserveItem();
 
   /// The counterpart of ReserveMemory, used to reset the item so that the item
@@ -180,13 +329,234 @@ class GarbageList : public IGarbageList {
   /// wait until the garbage list is full. Currently (May 2016) the only user is
   /// MwCAS' descriptor pool which we'd like to keep small. Tedious to tune the
   /// descriptor pool size vs. garbage list size, so there is this function.
-  int32_t Scavenge();
+  ///
+  /// Made to be called in small slices, e.g. from an idle loop: each call
+  /// resumes where the previous one (on any thread) stopped, takes the ring
+  /// kScavengeChunk slots at a time and examines at most \a max_slots of
+  /// them (rounded up to whole chunks; 0 means one lap of the ring). It
+  /// stops early once \a budget has elapsed, if one is given; time is only
+  /// read between chunks, so a call may overrun by one chunk and its destroy
+  /// callbacks. Empty slots, slots in use by other threads and items that
+  /// are not safe yet cost one load each. A call that finishes a lap also
+  /// sweeps the overflow, unless another thread is sweeping it.
+  ///
+  /// \return The number of items destroyed.
+  int32_t Scavenge(size_t max_slots = 0,
+                   std::chrono::nanoseconds budget =
+                       std::chrono::nanoseconds::zero());
 
   /// Returns (a pointer to) the epoch manager associated with this garbage
   /// list.
   EpochManager* GetEpoch();
 
+  /// Fill \a stats with the list's EpochManager's snapshot (see
+  /// EpochManager::GetStats()) plus the number of items on the ring and, in
+  /// EPOCH_STATS builds, the list's counters and latency histograms.
+  void GetStats(ReclamationStats* stats);
+
+  /// Start a background thread that, every \a interval, bumps the epoch
+  /// (which recomputes the safe-to-reclaim epoch) and destroys every item
+  /// that has become safe, in ring order. While it runs Push(), PushBatch()
+  /// and ReserveItem() only fill empty slots and never run destroy callbacks
+  /// or bump the epoch themselves, which keeps arbitrary destructors off
+  /// latency-sensitive threads. Destroy callbacks then run on the reclaimer
+  /// thread and must be safe to call from there.
+  ///
+  /// \param interval
+  ///      How often the reclaimer advances the epoch and sweeps the ring.
+  /// \param max_lag
+  ///      How many slots the reclaimer may trail the tail of the ring by.
+  ///      Beyond that, pushers go back to recycling the slots they land on
+  ///      inline, as without a reclaimer, so memory use stays bounded even if
+  ///      the reclaimer is starved. 0 means half of the ring.
+  ///
+  /// \retval false The list is not initialized or a reclaimer already runs.
+  bool StartReclaimer(std::chrono::microseconds interval,
+                      uint64_t max_lag = 0);
+
+  /// Stop and join the reclaimer thread. Items it has not reclaimed yet stay
+  /// on the list and are recycled by later pushes as usual.
+  bool StopReclaimer();
+
+  /// Repeatedly bump the epoch and sweep the whole ring until no pushed
+  /// items are left on it or in the overflow (slots held through
+  /// ReserveItem() don't count), or until \a timeout expires (e.g. because a
+  /// thread stays protected). Works with or without a running reclaimer.
+  ///
+  /// \retval true The ring was empty when Drain() returned.
+  bool Drain(std::chrono::milliseconds timeout);
+
  private:
+  /// Thread-local set of the RetireBuffers a thread owns, one per list it has
+  /// retired into; publishes leftovers when the thread exits.
+  struct ThreadRetireBuffers {
+    std::vector<RetireBuffer*> buffers;
+    ~ThreadRetireBuffers();
+  };
+  static thread_local ThreadRetireBuffers tls_retire_buffers_;
+
+  /// Drives its shards' reclamation from one thread; see AttachReclaimer().
+  friend class ShardedGarbageList;
+
+  enum ClaimResult {
+    kClaimed,
+
+    /// The slot is being modified by someone else, or its item is left to
+    /// the reclaimer.
+    kClaimBusy,
+
+    /// The slot's item is not safe to reclaim yet.
+    kClaimUnsafe,
+  };
+
+  /// Claim the ring slot for \a ticket (a value returned by incrementing
+  /// #tail_), destroying the previous occupant if it is safe to do so and
+  /// the caller is expected to recycle (see RecycleInline()). On success the
+  /// slot's removal_epoch is left as #invalid_epoch and the caller must fill
+  /// it with StoreItem(); \a slot is set either way.
+  ClaimResult TryClaimSlot(int64_t ticket, int64_t* slot);
+
+  /// Whether a pusher holding \a ticket should destroy and replace occupied
+  /// slots itself rather than leave them to the background reclaimer.
+  bool RecycleInline(int64_t ticket);
+
+  /// Items taken off the ring by a sweep and not destroyed yet.
+  struct DestroyBatch {
+    Item items[kDestroyBatchSize];
+    size_t count;
+  };
+
+  /// If the item in \a slot is safe to reclaim, move it into \a batch and
+  /// empty the slot. Returns true if an item was taken.
+  bool ReclaimSlot(int64_t slot, DestroyBatch* batch);
+
+  /// Returns a mask with bit i set if the removal epoch of slot
+  /// \a first + i is neither 0 nor above \a limit (so #invalid_epoch only
+  /// counts if \a limit is #invalid_epoch), for i < \a count <= 64. Only a
+  /// hint when slots change concurrently; see SetVectorSweep().
+  uint64_t SlotMask(size_t first, size_t count, Epoch limit);
+
+  /// Add \a item to \a batch, destroying the batch first if it is full.
+  void AddToBatch(DestroyBatch* batch, const Item& item);
+
+  /// Destroy every item in \a batch, one call per (callback, context) group
+  /// for callbacks with a registered batch counterpart, and empty it.
+  void DestroyItems(DestroyBatch* batch);
+
+  /// Reclaim safe items in ticket order starting at #reclaim_cursor_ and
+  /// advance the cursor up to the first item that is not safe yet or is
+  /// still being filled in.
+  void SweepFromCursor();
+
+  /// Body of the reclaimer thread.
+  void ReclaimerLoop();
+
+  /// Ring slot of \a ticket; see SetSlotSpread().
+  int64_t SlotOf(int64_t ticket) {
+    uint64_t index = (ticket - 1) & (item_count_ - 1);
+    if (!slot_rotation_) return index;
+    return ((index << slot_rotation_) |
+            (index >> (ring_bits_ - slot_rotation_))) &
+           (item_count_ - 1);
+  }
+
+  /// Switch pushers to reclaimer mode (see StartReclaimer()) for a
+  /// reclaimer that calls Reclaim() from some other thread, and back.
+  void AttachReclaimer(uint64_t max_lag);
+  void DetachReclaimer();
+
+  /// One reclaimer pass over the ring and the overflow, without bumping the
+  /// epoch.
+  void Reclaim();
+
+  /// Fill a slot claimed with TryClaimSlot().
+  void StoreItem(int64_t slot, void* removed_item, DestroyCallback callback,
+                 void* context, Epoch removal_epoch);
+
+  /// Claim a ring slot for the item, giving up as TryPush() does.
+  bool PushToRing(void* removed_item, DestroyCallback callback, void* context,
+                  Epoch removal_epoch);
+
+  /// Push() with an epoch already read by the caller. If \a force, spills
+  /// past the overflow limit rather than fail.
+  bool PushStamped(void* removed_item, DestroyCallback callback,
+                   void* context, Epoch removal_epoch, bool force = false);
+
+  /// PushBatch(), optionally with \a force as for PushStamped().
+  size_t PublishBatch(const Item* items, size_t count, bool force);
+
+  /// A chunk of the overflow. Segments form a list from the newest, which
+  /// pushers fill, through older ones, which only sweeps touch. Slots are
+  /// used once: removal_epoch is 0 until the item is stored, then its epoch
+  /// and #invalid_epoch after it has been destroyed.
+  struct OverflowSegment {
+    /// Next older segment. Set before the segment is published; only the
+    /// sweeper changes it afterwards.
+    OverflowSegment* next;
+
+    /// Slots handed out so far; keeps counting past kOverflowSegmentSize
+    /// once the segment is full.
+    std::atomic<uint32_t> used;
+
+    /// Slots before this one are destroyed; only the sweeper uses it.
+    uint32_t swept;
+
+    Item items[kOverflowSegmentSize];
+  };
+
+  /// Store an item in the overflow, adding a segment if the newest is full
+  /// and the limit (unless \a force) allows. Returns false if it does not.
+  bool Spill(void* removed_item, DestroyCallback callback, void* context,
+             Epoch removal_epoch, bool force);
+
+  /// Destroy overflow items that have become safe and free drained
+  /// segments. Unless \a wait, returns right away with SIZE_MAX if another
+  /// thread is sweeping. Returns the number of items left on the overflow.
+  /// If \a destroyed, adds the number of items destroyed to it.
+  size_t SweepOverflow(bool wait, size_t* destroyed = nullptr);
+
+  /// Find (or create and register) the calling thread's buffer for this list.
+  RetireBuffer* GetRetireBuffer();
+
+  /// The calling thread's buffer for this list, nullptr if it has none.
+  RetireBuffer* FindRetireBuffer();
+
+  /// Publish \a buffer, keeping what could not be taken (see Retire()).
+  void FlushRetireBuffer(RetireBuffer* buffer, bool force = false);
+
+  /// UnprotectHook callback; flushes the RetireBuffer it is embedded in, or
+  /// unhooks it if its list is gone.
+  static void OnUnprotect(EpochManager::UnprotectHook* hook);
+
+#ifdef EPOCH_STATS
+  enum Stat {
+    kStatPushes,
+    kStatPushRetriesUnsafe,
+    kStatPushRetriesBusy,
+    kStatItemsDestroyed,
+    kStatSpills,
+    kStatLatencyEpochs,
+    kStatLatencyNs = kStatLatencyEpochs + ReclamationStats::kHistogramBuckets,
+    kStatCount = kStatLatencyNs + ReclamationStats::kHistogramBuckets
+  };
+  StatCounters<kStatCount> stats_;
+
+  /// Count the destruction of an item retired in \a removal_epoch.
+  void RecordDestroyed(Epoch removal_epoch);
+#endif
+
+  /// Guards RetireBuffer::owner and every list's #retire_buffers_, so that
+  /// thread exit and Uninitialize() agree on who releases a buffer.
+  inline static std::mutex retire_buffers_mutex_;
+
+  /// Retire buffers created by threads for this list.
+  std::vector<RetireBuffer*> retire_buffers_;
+
+  /// The ShardedGarbageList this list is the first shard of, if any. Its
+  /// threads' retire buffers are kept here but published to whichever shard
+  /// the flushing thread's CPU maps to; see ShardedGarbageList::Retire().
+  ShardedGarbageList* sharded_;
+
   /// EpochManager instance that is used to determine when it is safe to
   /// free up items. Specifically, it is used to stamp items during Push()
   /// with the current epoch, and it is used in to ensure
@@ -201,6 +571,14 @@ class GarbageList : public IGarbageList {
   /// Size of the #m_items array. Must be a power of two.
   size_t item_count_;
 
+  /// log2(#item_count_), and by how many bits SlotOf() rotates the slot
+  /// index left (0 for the packed mapping); see SetSlotSpread().
+  uint32_t ring_bits_;
+  uint32_t slot_rotation_;
+
+  /// See SetVectorSweep().
+  bool vector_sweep_;
+
   /// Ring of addresses the addresses pushed to the list and metadata about
   /// them needed to determine when it is safe to free them and how they
   /// should be freed. This is filled as a ring; when a new Push() comes that
@@ -208,7 +586,102 @@ class GarbageList : public IGarbageList {
   /// if possible.
   Item* items_;
 
+  /// Background reclaimer thread; see StartReclaimer().
+  std::thread reclaimer_;
+
+  /// Whether #reclaimer_ is running; read by pushers on every claim.
+  std::atomic<bool> reclaimer_running_;
+
+  /// Tickets below this have been swept by the reclaimer. Only the reclaimer
+  /// writes it; pushers compare it to their ticket to bound the lag.
+  std::atomic<int64_t> reclaim_cursor_;
+
+  /// Number of sweeps in a row that stopped at a slot still being filled,
+  /// and that slot's ticket; see kMaxInFlightSweeps.
+  uint32_t in_flight_sweeps_;
+  int64_t in_flight_ticket_;
+
+  /// Slots handed out to Scavenge() calls so far; the next chunk starts at
+  /// this modulo #item_count_.
+  std::atomic<uint64_t> scavenge_cursor_;
+
+  /// See StartReclaimer().
+  int64_t max_lag_;
+  std::chrono::microseconds reclaimer_interval_;
+
+  /// Wakes the reclaimer early to stop.
+  std::mutex reclaimer_mutex_;
+  std::condition_variable reclaimer_cv_;
+  bool reclaimer_stop_;
+
+  /// Newest overflow segment, nullptr while there is none.
+  std::atomic<OverflowSegment*> overflow_head_;
+
+  /// Segments allocated and not freed yet, and how many may be.
+  std::atomic<size_t> overflow_segments_;
+  size_t max_overflow_segments_;
+
+  /// Pushers currently holding a pointer to some segment; unlinked segments
+  /// are only freed when none is.
+  std::atomic<uint64_t> overflow_pushers_;
+
+  /// Held by the thread sweeping the overflow; guards
+  /// #unlinked_segments_ and every segment's next and swept.
+  std::mutex overflow_mutex_;
+  std::vector<OverflowSegment*> unlinked_segments_;
+
+  /// Pairs registered with RegisterBatchDestroyCallback().
+  DestroyCallback batch_keys_[kMaxBatchDestroyCallbacks];
+  BatchDestroyCallback batch_callbacks_[kMaxBatchDestroyCallbacks];
+  size_t batch_callback_count_;
+
 #ifdef PMEM
   PMEMobjpool* pmdk_pool_;
 #endif
 };
+
+/// Holds the items whose GarbageList::Retire() was refused during one
+/// operation of a lock-free structure and pushes them once the operation's
+/// EpochGuard is gone; declare it before the guard so it is destroyed after
+/// it. Push() is then retried, yielding in between, until the list takes each
+/// item, which throttles a thread that retires faster than readers move on.
+///
+/// A thread still protected at that point (by an outer guard) may itself be
+/// what holds reclamation back, so it does not wait: its items are kept per
+/// thread and pushed by the next PendingRetires it destroys unprotected.
+class PendingRetires {
+ public:
+  explicit PendingRetires(GarbageList* garbage_list)
+      : garbage_list_{garbage_list}, items_{} {}
+  ~PendingRetires() {
+    if (!items_.empty() || tls_leftover_count_) PushAll();
+  }
+
+  PendingRetires(const PendingRetires&) = delete;
+  PendingRetires& operator=(const PendingRetires&) = delete;
+
+  /// GarbageList::Retire(), keeping \a removed_item for the destructor if it
+  /// is refused.
+  void Retire(void* removed_item, IGarbageList::DestroyCallback callback,
+              void* context) {
+    if (garbage_list_->Retire(removed_item, callback, context)) return;
+    items_.push_back({garbage_list_, removed_item, callback, context});
+  }
+
+ private:
+  struct Pending {
+    GarbageList* garbage_list;
+    void* removed_item;
+    IGarbageList::DestroyCallback callback;
+    void* context;
+  };
+
+  void PushAll();
+
+  GarbageList* garbage_list_;
+  std::vector<Pending> items_;
+
+  /// Items left by PendingRetires destroyed while protected.
+  static thread_local std::vector<Pending> tls_leftovers_;
+  inline static thread_local size_t tls_leftover_count_;
+};
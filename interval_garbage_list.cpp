@@ -0,0 +1,255 @@
+#include "interval_garbage_list.h"
+#include <algorithm>
+#include <cstdlib>
+
+IntervalGarbageList::IntervalGarbageList()
+    : reservations_{},
+      reservation_count_{},
+      era_{1},
+      orphan_count_{},
+      initialized_{} {}
+IntervalGarbageList::~IntervalGarbageList() { Uninitialize(); }
+
+bool IntervalGarbageList::Initialize(EpochManager* epoch_manager,
+                                     size_t reservations) {
+  (void)epoch_manager;
+  if (initialized_) return true;
+  if (!reservations) return false;
+
+  void* mem = nullptr;
+  if (posix_memalign(&mem, very_pm::kCacheLineSize,
+                     sizeof(Reservation) * reservations)) {
+    return false;
+  }
+  reservations_ = static_cast<Reservation*>(mem);
+  for (size_t i = 0; i < reservations; ++i) {
+    new (&reservations_[i]) Reservation{};
+    reservations_[i].lower.store(kNoEra, std::memory_order_relaxed);
+    reservations_[i].upper.store(kNoEra, std::memory_order_relaxed);
+  }
+  reservation_count_ = reservations;
+  era_.store(1, std::memory_order_relaxed);
+  orphan_count_.store(0, std::memory_order_relaxed);
+  initialized_ = true;
+  return true;
+}
+bool IntervalGarbageList::Uninitialize() {
+  if (!initialized_) return true;
+
+  // Take everything still retired; the ThreadStates themselves belong to
+  // their threads and are freed when those exit.
+  std::vector<Retired> leftovers;
+  {
+    std::unique_lock<std::mutex> lock(states_mutex_);
+    for (ThreadState* state : states_) {
+      leftovers.insert(leftovers.end(), state->retired.begin(),
+                       state->retired.end());
+      state->retired.clear();
+      state->outstanding.store(0, std::memory_order_relaxed);
+      state->reservation = nullptr;
+      state->owner = nullptr;
+    }
+    states_.clear();
+    leftovers.insert(leftovers.end(), orphans_.begin(), orphans_.end());
+    orphans_.clear();
+    orphan_count_.store(0, std::memory_order_relaxed);
+  }
+  for (Retired& retired : leftovers) {
+    retired.destroy_callback(retired.destroy_callback_context,
+                             retired.removed_item);
+  }
+
+  free(reservations_);
+  reservations_ = nullptr;
+  reservation_count_ = 0;
+  initialized_ = false;
+  return true;
+}
+bool IntervalGarbageList::Push(void* removed_item, DestroyCallback callback,
+                               void* context) {
+  return Push(removed_item, 0, callback, context);
+}
+bool IntervalGarbageList::Push(void* removed_item, Era birth_era,
+                               DestroyCallback callback, void* context) {
+  ThreadState* state = GetThreadState();
+  // The object is already unlinked, so any era read from here on is at least
+  // its real retirement era.
+  Era retire_era = era_.load(std::memory_order_seq_cst);
+  state->retired.push_back(
+      Retired{removed_item, callback, context, birth_era, retire_era});
+  state->outstanding.store(state->retired.size(), std::memory_order_relaxed);
+  CountOperation(state);
+  if (state->retired.size() >= state->scan_at) Scan();
+  return true;
+}
+IntervalGarbageList::Era IntervalGarbageList::OnAllocate() {
+  ThreadState* state = GetThreadState();
+  CountOperation(state);
+  return era_.load(std::memory_order_acquire);
+}
+void IntervalGarbageList::CountOperation(ThreadState* state) {
+  if (++state->operations % kEraAdvanceInterval == 0) {
+    era_.fetch_add(1, std::memory_order_acq_rel);
+  }
+}
+bool IntervalGarbageList::Protect() { return Enter() != nullptr; }
+IntervalGarbageList::Reservation* IntervalGarbageList::Enter() {
+  ThreadState* state = GetThreadState();
+  if (state->nesting) {
+    ++state->nesting;
+    return state->reservation;
+  }
+
+  Reservation* reservation = state->reservation;
+  if (!reservation) {
+    for (size_t i = 0; i < reservation_count_ && !reservation; ++i) {
+      bool expected = false;
+      if (!reservations_[i].taken.load(std::memory_order_relaxed) &&
+          reservations_[i].taken.compare_exchange_strong(expected, true)) {
+        reservation = &reservations_[i];
+      }
+    }
+    if (!reservation) return nullptr;
+    state->reservation = reservation;
+  }
+
+  // Scanners read lower before upper, so publishing upper first means they
+  // never see the new lower end with a stale upper end.
+  Era era = era_.load(std::memory_order_acquire);
+  reservation->upper.store(era, std::memory_order_relaxed);
+  reservation->lower.store(era, std::memory_order_seq_cst);
+  state->nesting = 1;
+  return reservation;
+}
+bool IntervalGarbageList::Unprotect() {
+  ThreadState* state = GetThreadState();
+  if (!state->nesting || --state->nesting) return true;
+  state->reservation->lower.store(kNoEra, std::memory_order_release);
+  return true;
+}
+size_t IntervalGarbageList::Scan() {
+  ThreadState* state = GetThreadState();
+  // Destroy callbacks may push to this list again, so scan a detached copy
+  // and merge whatever survives back in afterwards.
+  std::vector<Retired> retired;
+  retired.swap(state->retired);
+  size_t destroyed = ScanRetired(&retired);
+  state->retired.insert(state->retired.end(), retired.begin(), retired.end());
+  state->scan_at = state->retired.size() + kScanThreshold;
+  state->outstanding.store(state->retired.size(), std::memory_order_relaxed);
+
+  if (orphan_count_.load(std::memory_order_relaxed)) {
+    std::vector<Retired> orphans;
+    {
+      std::unique_lock<std::mutex> lock(states_mutex_);
+      orphans.swap(orphans_);
+    }
+    destroyed += ScanRetired(&orphans);
+    std::unique_lock<std::mutex> lock(states_mutex_);
+    orphans_.insert(orphans_.end(), orphans.begin(), orphans.end());
+    orphan_count_.store(orphans_.size(), std::memory_order_relaxed);
+  }
+  return destroyed;
+}
+size_t IntervalGarbageList::ScanRetired(std::vector<Retired>* retired) {
+  if (retired->empty()) return 0;
+
+  // Snapshot the active intervals once per scan.
+  std::vector<std::pair<Era, Era>> intervals;
+  for (size_t i = 0; i < reservation_count_; ++i) {
+    Reservation& reservation = reservations_[i];
+    Era lower = reservation.lower.load(std::memory_order_acquire);
+    if (lower == kNoEra) continue;
+    Era upper = reservation.upper.load(std::memory_order_acquire);
+    intervals.emplace_back(lower, upper);
+  }
+
+  size_t kept = 0;
+  size_t destroyed = 0;
+  for (size_t i = 0; i < retired->size(); ++i) {
+    Retired& candidate = (*retired)[i];
+    bool conflict = false;
+    for (auto& interval : intervals) {
+      if (candidate.birth_era <= interval.second &&
+          candidate.retire_era >= interval.first) {
+        conflict = true;
+        break;
+      }
+    }
+    if (conflict) {
+      (*retired)[kept++] = candidate;
+      continue;
+    }
+    candidate.destroy_callback(candidate.destroy_callback_context,
+                               candidate.removed_item);
+    ++destroyed;
+  }
+  retired->resize(kept);
+  return destroyed;
+}
+size_t IntervalGarbageList::GetOutstanding() {
+  std::unique_lock<std::mutex> lock(states_mutex_);
+  size_t outstanding = orphans_.size();
+  for (ThreadState* state : states_) {
+    outstanding += state->outstanding.load(std::memory_order_relaxed);
+  }
+  return outstanding;
+}
+
+thread_local IntervalGarbageList::ThreadStates
+    IntervalGarbageList::tls_states_;
+
+IntervalGarbageList::ThreadState* IntervalGarbageList::GetThreadState() {
+  std::vector<ThreadState*>& states = tls_states_.states;
+  for (ThreadState* state : states) {
+    if (state->owner == this) return state;
+  }
+
+  // Drop states of lists that were uninitialized since; they hold nothing.
+  {
+    std::unique_lock<std::mutex> lock(states_mutex_);
+    auto dead = std::remove_if(states.begin(), states.end(),
+                               [](ThreadState* state) {
+                                 if (state->owner) return false;
+                                 delete state;
+                                 return true;
+                               });
+    states.erase(dead, states.end());
+  }
+
+  ThreadState* state = new ThreadState{};
+  state->owner = this;
+  state->scan_at = kScanThreshold;
+  {
+    std::unique_lock<std::mutex> lock(states_mutex_);
+    states_.push_back(state);
+  }
+  states.push_back(state);
+  return state;
+}
+IntervalGarbageList::ThreadStates::~ThreadStates() {
+  std::unique_lock<std::mutex> lock(states_mutex_);
+  for (ThreadState* state : states) {
+    IntervalGarbageList* owner = state->owner;
+    if (owner) {
+      // Hand what is left to the list and give the reservation back.
+      auto& registered = owner->states_;
+      registered.erase(std::find(registered.begin(), registered.end(), state));
+      owner->orphans_.insert(owner->orphans_.end(), state->retired.begin(),
+                             state->retired.end());
+      owner->orphan_count_.store(owner->orphans_.size(),
+                                 std::memory_order_relaxed);
+      if (state->reservation) {
+        state->reservation->lower.store(kNoEra, std::memory_order_release);
+        state->reservation->taken.store(false, std::memory_order_release);
+      }
+    }
+    delete state;
+  }
+}
+
+IntervalGuard::IntervalGuard(IntervalGarbageList* list)
+    : list_{list}, reservation_{list->Enter()} {}
+IntervalGuard::~IntervalGuard() {
+  if (reservation_) list_->Unprotect();
+}
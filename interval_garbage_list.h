@@ -0,0 +1,222 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "garbage_list.h"
+
+/// Interval-based reclamation (2GE-IBR, Wen et al., PPoPP'18) behind the
+/// IGarbageList interface, for workloads where a reader may stall while
+/// protected.
+///
+/// With GarbageList a single thread that stays inside Protect() pins the
+/// safe-to-reclaim epoch, so nothing retired after it entered can be freed
+/// and pushers end up spinning on a full ring. Here every object carries the
+/// era it was allocated in (its birth era, see OnAllocate()) and the era it
+/// was retired in, and every reader publishes the interval of eras it has
+/// been reading in. An object is only held back by readers whose interval
+/// overlaps its lifetime, so a stalled reader pins the objects that were
+/// alive while it was reading and nothing that was allocated afterwards.
+///
+/// Readers bracket their accesses with an IntervalGuard (or Protect() and
+/// Unprotect()) and load shared pointers through IntervalGuard::Read(), which
+/// extends the published interval to the current era. Objects pushed without
+/// a birth era are treated as born in era 0, i.e. with plain epoch-based
+/// semantics.
+///
+/// Retired objects are kept in per-thread lists and scanned by their retiring
+/// thread every kScanThreshold pushes; there is no shared ring to fill up.
+class IntervalGarbageList : public IGarbageList {
+ public:
+  typedef uint64_t Era;
+
+  /// Published as the lower end of an idle reservation.
+  inline static const constexpr Era kNoEra = ~0llu;
+
+  /// Each thread advances the global era once per this many allocations and
+  /// retirements it makes.
+  inline static const constexpr uint64_t kEraAdvanceInterval = 64;
+
+  /// A thread scans its retired objects once it has retired this many since
+  /// its last scan, so objects a stalled reader pins are not rescanned on
+  /// every push.
+  inline static const constexpr size_t kScanThreshold = 128;
+
+  /// Default number of reservation slots, i.e. threads that may be inside
+  /// Protect() at the same time.
+  inline static const constexpr size_t kDefaultReservations = 256;
+
+  /// The interval of eras a thread may be reading objects from. Only the
+  /// owning thread writes it; scanners read it.
+  struct alignas(very_pm::kCacheLineSize) Reservation {
+    std::atomic<Era> lower;
+    std::atomic<Era> upper;
+
+    /// Set while a thread owns this reservation.
+    std::atomic<bool> taken;
+  };
+
+  /// An object waiting for every reader that may hold it to move on.
+  struct Retired {
+    void* removed_item;
+    DestroyCallback destroy_callback;
+    void* destroy_callback_context;
+    Era birth_era;
+    Era retire_era;
+  };
+
+  IntervalGarbageList();
+  virtual ~IntervalGarbageList();
+
+  /// Initialize the list. \a epoch_manager is not used (eras replace epochs
+  /// here) and may be nullptr; it is only taken to fit IGarbageList.
+  /// \a reservations is the number of threads that may be protected at the
+  /// same time.
+  ///
+  /// \retval false \a reservations was 0 or allocation failed.
+  virtual bool Initialize(EpochManager* epoch_manager,
+                          size_t reservations = kDefaultReservations);
+
+  /// Destroy every object still retired, regardless of readers, and release
+  /// the reservations. As with GarbageList, no thread may be accessing
+  /// objects on the list any more.
+  virtual bool Uninitialize();
+
+  /// Retire an object that was born in era 0; see the Push() overload.
+  virtual bool Push(void* removed_item, DestroyCallback callback,
+                    void* context);
+
+  /// Retire \a removed_item, which was allocated in \a birth_era (as returned
+  /// by OnAllocate() when it was created). \a callback is invoked with
+  /// \a context and the object once no reader's interval overlaps
+  /// [birth_era, current era].
+  bool Push(void* removed_item, Era birth_era, DestroyCallback callback,
+            void* context);
+
+  /// Note an allocation by the calling thread and return the birth era to
+  /// record with the new object; advances the era now and then.
+  Era OnAllocate();
+
+  /// Current global era.
+  Era GetCurrentEra() { return era_.load(std::memory_order_acquire); }
+
+  /// Enter the protected region: publish [era, era] as the calling thread's
+  /// reservation. Calls nest like EpochManager::Protect().
+  ///
+  /// \retval false All reservations are taken by other threads.
+  bool Protect();
+
+  /// Leave the protected region entered by the matching Protect().
+  bool Unprotect();
+
+  /// Scan the calling thread's retired objects (and those left behind by
+  /// exited threads) and destroy every one no reservation overlaps.
+  /// \return The number of objects destroyed.
+  size_t Scan();
+
+  /// Number of objects pushed and not destroyed yet, across all threads.
+  /// Approximate while other threads push or scan.
+  size_t GetOutstanding();
+
+ private:
+  friend class IntervalGuard;
+
+  /// What a thread keeps for each list it has used.
+  struct ThreadState {
+    /// List this state belongs to; nullptr once the list was uninitialized.
+    /// Guarded by #states_mutex_ for writes.
+    IntervalGarbageList* owner;
+
+    /// Reservation taken on first Protect(), or nullptr.
+    Reservation* reservation;
+
+    /// Protect() calls not yet matched by Unprotect().
+    uint32_t nesting;
+
+    /// Allocations and retirements since the era was last advanced.
+    uint64_t operations;
+
+    /// Retired objects still waiting; only touched by the owning thread.
+    std::vector<Retired> retired;
+
+    /// Size of #retired at which the next automatic scan runs.
+    size_t scan_at;
+
+    /// retired.size(), readable by GetOutstanding().
+    std::atomic<size_t> outstanding;
+  };
+
+  /// Thread-local set of a thread's ThreadStates; hands leftovers to their
+  /// lists when the thread exits.
+  struct ThreadStates {
+    std::vector<ThreadState*> states;
+    ~ThreadStates();
+  };
+  static thread_local ThreadStates tls_states_;
+
+  /// Find (or create and register) the calling thread's state for this list.
+  ThreadState* GetThreadState();
+
+  /// Protect() for the calling thread; returns its reservation, or nullptr
+  /// if none was free.
+  Reservation* Enter();
+
+  /// Count one allocation or retirement by \a state, advancing the era every
+  /// kEraAdvanceInterval of them.
+  void CountOperation(ThreadState* state);
+
+  /// Destroy the objects in \a retired that no reservation overlaps and
+  /// compact the rest to the front. Returns the number destroyed.
+  size_t ScanRetired(std::vector<Retired>* retired);
+
+  /// Reserved slots readers publish their intervals in.
+  Reservation* reservations_;
+  size_t reservation_count_;
+
+  /// Global era clock.
+  alignas(very_pm::kCacheLineSize) std::atomic<Era> era_;
+
+  /// Guards ThreadState::owner, #states_ and #orphans_.
+  inline static std::mutex states_mutex_;
+
+  /// States created by threads for this list.
+  std::vector<ThreadState*> states_;
+
+  /// Objects left over by threads that exited; scanned by whichever thread
+  /// scans next.
+  std::vector<Retired> orphans_;
+  std::atomic<size_t> orphan_count_;
+
+  bool initialized_;
+};
+
+/// EpochGuard counterpart for IntervalGarbageList: protects on construction,
+/// unprotects on destruction and loads shared pointers via Read().
+class IntervalGuard {
+ public:
+  explicit IntervalGuard(IntervalGarbageList* list);
+  ~IntervalGuard();
+
+  /// False if the list had no free reservation; Read() must not be used then.
+  bool IsProtected() const { return reservation_ != nullptr; }
+
+  /// Load \a source and extend the thread's reservation to the era the load
+  /// happened in, so the object read stays protected until the guard goes
+  /// away.
+  template <typename T>
+  T* Read(const std::atomic<T*>& source) {
+    IntervalGarbageList::Era upper =
+        reservation_->upper.load(std::memory_order_relaxed);
+    for (;;) {
+      T* value = source.load(std::memory_order_acquire);
+      IntervalGarbageList::Era era = list_->GetCurrentEra();
+      if (era == upper) return value;
+      reservation_->upper.store(era, std::memory_order_seq_cst);
+      upper = era;
+    }
+  }
+
+ private:
+  IntervalGarbageList* list_;
+  IntervalGarbageList::Reservation* reservation_;
+};
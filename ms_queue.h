@@ -0,0 +1,119 @@
+#pragma once
+#include <atomic>
+#include "garbage_list.h"
+
+/// Lock-free FIFO queue (Michael and Scott, PODC'96) whose dequeued nodes are
+/// reclaimed through a GarbageList.
+///
+/// The queue always holds a dummy node at its head; Dequeue() returns the
+/// value of the node after it, makes that node the new dummy and retires the
+/// old one. Enqueue() and Dequeue() run inside an EpochGuard, so the nodes
+/// they traverse stay valid even if another thread dequeues them meanwhile.
+template <typename T>
+class MSQueue {
+ public:
+  MSQueue()
+      : head_{nullptr}, tail_{nullptr}, epoch_manager_{}, garbage_list_{} {}
+  ~MSQueue() { Uninitialize(); }
+
+  MSQueue(const MSQueue&) = delete;
+  MSQueue& operator=(const MSQueue&) = delete;
+
+  /// Use \a garbage_list, which must be initialized with \a epoch_manager,
+  /// to reclaim dequeued nodes.
+  bool Initialize(EpochManager* epoch_manager, GarbageList* garbage_list) {
+    if (epoch_manager_) return true;
+    if (!epoch_manager || !garbage_list) return false;
+    Node* dummy = new Node{T{}, nullptr};
+    head_.store(dummy, std::memory_order_relaxed);
+    tail_.store(dummy, std::memory_order_relaxed);
+    epoch_manager_ = epoch_manager;
+    garbage_list_ = garbage_list;
+    return true;
+  }
+
+  /// Delete the nodes still in the queue. No thread may use it any more.
+  bool Uninitialize() {
+    if (!epoch_manager_) return true;
+    Node* node = head_.load(std::memory_order_relaxed);
+    while (node) {
+      Node* next = node->next.load(std::memory_order_relaxed);
+      delete node;
+      node = next;
+    }
+    head_.store(nullptr, std::memory_order_relaxed);
+    tail_.store(nullptr, std::memory_order_relaxed);
+    epoch_manager_ = nullptr;
+    garbage_list_ = nullptr;
+    return true;
+  }
+
+  void Enqueue(const T& value) {
+    Node* node = new Node{value, nullptr};
+    EpochGuard guard(epoch_manager_);
+    for (;;) {
+      Node* tail = tail_.load(std::memory_order_acquire);
+      Node* next = tail->next.load(std::memory_order_acquire);
+      if (tail != tail_.load(std::memory_order_acquire)) continue;
+      if (next) {
+        // Tail is lagging; help the enqueuer that linked next.
+        tail_.compare_exchange_weak(tail, next, std::memory_order_release,
+                                    std::memory_order_relaxed);
+        continue;
+      }
+      if (tail->next.compare_exchange_weak(next, node,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+        tail_.compare_exchange_strong(tail, node, std::memory_order_release,
+                                      std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
+  /// Dequeue the oldest value into \a value.
+  /// \retval false The queue was empty.
+  bool Dequeue(T* value) {
+    PendingRetires pending(garbage_list_);
+    EpochGuard guard(epoch_manager_);
+    for (;;) {
+      Node* head = head_.load(std::memory_order_acquire);
+      Node* tail = tail_.load(std::memory_order_acquire);
+      Node* next = head->next.load(std::memory_order_acquire);
+      if (head != head_.load(std::memory_order_acquire)) continue;
+      if (!next) return false;
+      if (head == tail) {
+        tail_.compare_exchange_weak(tail, next, std::memory_order_release,
+                                    std::memory_order_relaxed);
+        continue;
+      }
+      // Read before the CAS: once next is the dummy another dequeuer may
+      // retire it.
+      T result = next->value;
+      if (head_.compare_exchange_weak(head, next, std::memory_order_acq_rel,
+                                      std::memory_order_relaxed)) {
+        *value = result;
+        pending.Retire(head, &MSQueue::DestroyNode, nullptr);
+        return true;
+      }
+    }
+  }
+
+ private:
+  struct Node {
+    T value;
+    std::atomic<Node*> next;
+  };
+
+  static void DestroyNode(void* context, void* node) {
+    (void)context;
+    delete static_cast<Node*>(node);
+  }
+
+  /// Dequeuers and enqueuers hit different ends; keep them on separate
+  /// cachelines.
+  alignas(very_pm::kCacheLineSize) std::atomic<Node*> head_;
+  alignas(very_pm::kCacheLineSize) std::atomic<Node*> tail_;
+  EpochManager* epoch_manager_;
+  GarbageList* garbage_list_;
+};
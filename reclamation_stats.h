@@ -0,0 +1,166 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "utils.h"
+
+// -- Reclamation statistics --
+// Build with -DEPOCH_STATS to have EpochManager, its MinEpochTable and
+// GarbageList count what they do in per-thread, cacheline-padded counters.
+// Without it the counters and every update of them are compiled out; the
+// snapshots then only carry the gauges (epochs, outstanding items) that can
+// be read off the structures themselves.
+
+#ifdef EPOCH_STATS
+#define EPOCH_STAT(statement) statement
+#else
+#define EPOCH_STAT(statement)
+#endif
+
+/// Snapshot of an EpochManager, and of a GarbageList if taken through
+/// GarbageList::GetStats() (summed over all shards for a ShardedGarbageList).
+/// Counters are totals since initialization, summed over all threads when
+/// the snapshot is taken, so they are only approximate while threads keep
+/// running.
+struct ReclamationStats {
+  /// Number of log2 buckets in the latency histograms.
+  inline static const constexpr size_t kHistogramBuckets = 32;
+
+  /// True if the counters below were compiled in (EPOCH_STATS); they are
+  /// all 0 otherwise.
+  bool counters_enabled;
+
+  // -- EpochManager --
+  uint64_t current_epoch;
+  uint64_t safe_to_reclaim_epoch;
+
+  /// current_epoch - safe_to_reclaim_epoch: how many epochs of retired
+  /// items can not be reclaimed yet.
+  uint64_t epoch_gap;
+
+  /// Outermost Protect() calls (nested ones only adjust a depth).
+  uint64_t protects;
+  uint64_t epoch_bumps;
+  uint64_t safe_epoch_computations;
+
+  /// Signals sent to threads lagging behind; see EnableNeutralization().
+  uint64_t neutralize_signals;
+
+  /// On-demand safe epoch recomputations by pushers stuck on an unsafe
+  /// item; see EpochManager::RefreshSafeToReclaimEpoch().
+  uint64_t safe_epoch_refreshes;
+
+  /// Safe epoch scans a bump or refresh left to a thread that was scanning
+  /// already; see EpochManager::CoalescedComputeSafeEpoch().
+  uint64_t coalesced_scans;
+
+  // -- MinEpochTable --
+  /// Entries reserved by threads using the manager for the first time.
+  uint64_t entries_reserved;
+
+  /// Entries visited by ComputeNewSafeToReclaimEpoch() scans.
+  uint64_t entries_scanned;
+
+  // -- GarbageList --
+  uint64_t pushes;
+
+  /// Push attempts that had to move on to another slot because its item
+  /// was not safe to reclaim yet.
+  uint64_t push_retries_unsafe;
+
+  /// Push attempts that had to move on because another thread held the
+  /// slot, won the race for it, or the slot was left to the reclaimer.
+  uint64_t push_retries_busy;
+
+  uint64_t items_destroyed;
+
+  /// Items on the ring and its overflow when the snapshot was taken.
+  uint64_t outstanding;
+
+  /// Pushes that went to the overflow because the ring was full of items
+  /// not safe to reclaim yet; see GarbageList::SetOverflowLimit().
+  uint64_t spills;
+
+  /// Overflow segments allocated when the snapshot was taken.
+  uint64_t overflow_segments;
+
+  // -- ShardedGarbageList --
+  /// Pushes that went to another CPU's shard because the ring of the
+  /// pusher's own was full of items not safe to reclaim yet.
+  uint64_t shard_steals;
+
+  /// Retire-to-free latency of destroyed items. Bucket 0 counts latencies
+  /// of 0, bucket i > 0 latencies in [2^(i-1), 2^i); the last bucket also
+  /// takes everything beyond.
+  uint64_t latency_epochs[kHistogramBuckets];
+
+  /// Same in nanoseconds, measured from the start of the epoch the item was
+  /// retired in (so an upper bound). Items retired in epochs too old for the
+  /// manager to remember when they started are not counted.
+  uint64_t latency_ns[kHistogramBuckets];
+};
+
+#ifdef EPOCH_STATS
+/// Histogram bucket of \a value; see ReclamationStats::latency_epochs.
+inline size_t StatBucket(uint64_t value) {
+  size_t bucket = value ? 64 - __builtin_clzll(value) : 0;
+  return bucket < ReclamationStats::kHistogramBuckets
+             ? bucket
+             : ReclamationStats::kHistogramBuckets - 1;
+}
+
+/// Monotonic clock the statistics measure latencies with.
+inline uint64_t StatNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// \a kCount counters kept once per thread (up to kShards threads; more
+/// share shards) so that updating them never bounces a cacheline between
+/// threads. Sum() adds up all shards.
+template <size_t kCount>
+class StatCounters {
+ public:
+  inline static const constexpr size_t kShards = 64;
+
+  StatCounters() : shards_{} {}
+
+  void Add(size_t counter, uint64_t value = 1) {
+    shards_[ShardIndex()].values[counter].fetch_add(
+        value, std::memory_order_relaxed);
+  }
+
+  uint64_t Sum(size_t counter) const {
+    uint64_t sum = 0;
+    for (const Shard& shard : shards_) {
+      sum += shard.values[counter].load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  void Reset() {
+    for (Shard& shard : shards_) {
+      for (auto& value : shard.values) {
+        value.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  struct alignas(very_pm::kCacheLineSize) Shard {
+    std::atomic<uint64_t> values[kCount];
+  };
+
+  /// Shard of the calling thread, assigned round-robin on first use.
+  static size_t ShardIndex() {
+    static std::atomic<size_t> next_shard{0};
+    thread_local size_t shard =
+        next_shard.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return shard;
+  }
+
+  Shard shards_[kShards];
+};
+#endif
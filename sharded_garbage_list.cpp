@@ -0,0 +1,229 @@
+#include "sharded_garbage_list.h"
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ_AREA 1
+#endif
+
+ShardedGarbageList::ShardedGarbageList()
+    : epoch_manager_{},
+      shards_{},
+      shard_count_{},
+      reclaimer_interval_{},
+      reclaimer_stop_{} {}
+ShardedGarbageList::~ShardedGarbageList() { Uninitialize(); }
+
+#ifdef PMEM
+bool ShardedGarbageList::Initialize(EpochManager* epoch_manager,
+                                    PMEMobjpool* pool_, size_t item_count,
+                                    size_t shard_count) {
+#else
+bool ShardedGarbageList::Initialize(EpochManager* epoch_manager,
+                                    size_t item_count, size_t shard_count) {
+#endif
+  if (epoch_manager_) return true;
+  if (!epoch_manager) return false;
+
+  if (!shard_count) {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    shard_count = cpus > 0 ? cpus : 1;
+  }
+  size_t shard_items = kMinShardItems;
+  while (shard_items * 2 <= item_count / shard_count) shard_items *= 2;
+
+  shards_ = new Shard[shard_count];
+  for (size_t i = 0; i < shard_count; ++i) {
+#ifdef PMEM
+    bool initialized =
+        shards_[i].list.Initialize(epoch_manager, pool_, shard_items);
+#else
+    bool initialized = shards_[i].list.Initialize(epoch_manager, shard_items);
+#endif
+    if (!initialized) {
+      delete[] shards_;
+      shards_ = nullptr;
+      return false;
+    }
+  }
+  // Retire buffers are per thread and list, not per shard; keep them in the
+  // first shard.
+  shards_[0].list.sharded_ = this;
+  shard_count_ = shard_count;
+  epoch_manager_ = epoch_manager;
+  EPOCH_STAT(stats_.Reset());
+  return true;
+}
+bool ShardedGarbageList::Uninitialize() {
+  if (!epoch_manager_) return true;
+
+  StopReclaimer();
+  // Retire buffers flush through the other shards, so detach them (and
+  // destroy what they stage) first. The rest uninitialize themselves on
+  // destruction.
+  shards_[0].list.Uninitialize();
+  delete[] shards_;
+  shards_ = nullptr;
+  shard_count_ = 0;
+  epoch_manager_ = nullptr;
+  return true;
+}
+size_t ShardedGarbageList::CurrentCpu() {
+#ifdef HAVE_RSEQ_AREA
+  // The kernel keeps cpu_id in the thread's rseq area current, so reading it
+  // costs a load instead of a call.
+  if (__rseq_size) {
+    struct rseq* area = reinterpret_cast<struct rseq*>(
+        static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+    int32_t cpu = (int32_t)__atomic_load_n(&area->cpu_id, __ATOMIC_RELAXED);
+    if (cpu >= 0) return cpu;
+  }
+#endif
+  int cpu = sched_getcpu();
+  if (cpu >= 0) return cpu;
+
+  static std::atomic<size_t> next_thread{0};
+  thread_local size_t thread_number =
+      next_thread.fetch_add(1, std::memory_order_relaxed);
+  return thread_number;
+}
+size_t ShardedGarbageList::GetCurrentShard() {
+  return CurrentCpu() % shard_count_;
+}
+bool ShardedGarbageList::Push(void* removed_item,
+                              IGarbageList::DestroyCallback callback,
+                              void* context) {
+  size_t home = GetCurrentShard();
+  if (shards_[home].list.TryPush(removed_item, callback, context)) {
+    return true;
+  }
+  // Our ring is full of items someone may still see; borrow a neighbour's
+  // before growing ours.
+  for (size_t i = 1; i < shard_count_; ++i) {
+    GarbageList& list = shards_[(home + i) % shard_count_].list;
+    if (list.TryPush(removed_item, callback, context)) {
+      EPOCH_STAT(stats_.Add(kStatShardSteals));
+      return true;
+    }
+  }
+  return shards_[home].list.Push(removed_item, callback, context);
+}
+bool ShardedGarbageList::Retire(void* removed_item,
+                                IGarbageList::DestroyCallback callback,
+                                void* context) {
+  if (shards_[0].list.Retire(removed_item, callback, context)) return true;
+  return Push(removed_item, callback, context);
+}
+bool ShardedGarbageList::FlushRetireBuffer() {
+  return shards_[0].list.FlushRetireBuffer();
+}
+size_t ShardedGarbageList::PublishBatch(const GarbageList::Item* items,
+                                        size_t count, bool force) {
+  size_t home = GetCurrentShard();
+  size_t taken = shards_[home].list.PublishBatch(items, count, force);
+  // Only a full overflow refuses items; try the neighbours' before giving
+  // them back to the buffer.
+  for (size_t i = 1; i < shard_count_ && taken < count; ++i) {
+    GarbageList& list = shards_[(home + i) % shard_count_].list;
+    size_t stolen = list.PublishBatch(items + taken, count - taken, force);
+    EPOCH_STAT(if (stolen) stats_.Add(kStatShardSteals));
+    taken += stolen;
+  }
+  return taken;
+}
+bool ShardedGarbageList::SetOverflowLimit(size_t max_items) {
+  for (size_t i = 0; i < shard_count_; ++i) {
+    shards_[i].list.SetOverflowLimit(max_items);
+  }
+  return true;
+}
+bool ShardedGarbageList::SetSlotSpread(bool spread) {
+  for (size_t i = 0; i < shard_count_; ++i) {
+    if (!shards_[i].list.SetSlotSpread(spread)) return false;
+  }
+  return true;
+}
+bool ShardedGarbageList::RegisterBatchDestroyCallback(
+    IGarbageList::DestroyCallback callback,
+    IGarbageList::BatchDestroyCallback batch_callback) {
+  for (size_t i = 0; i < shard_count_; ++i) {
+    if (!shards_[i].list.RegisterBatchDestroyCallback(callback,
+                                                      batch_callback)) {
+      return false;
+    }
+  }
+  return true;
+}
+void ShardedGarbageList::ReclaimerLoop() {
+  std::unique_lock<std::mutex> lock(reclaimer_mutex_);
+  while (!reclaimer_stop_) {
+    reclaimer_cv_.wait_for(lock, reclaimer_interval_);
+    if (reclaimer_stop_) break;
+    lock.unlock();
+    // One bump serves every shard; they all read the same safe epoch.
+    epoch_manager_->BumpCurrentEpoch();
+    for (size_t i = 0; i < shard_count_; ++i) shards_[i].list.Reclaim();
+    lock.lock();
+  }
+}
+bool ShardedGarbageList::StartReclaimer(std::chrono::microseconds interval,
+                                        uint64_t max_lag) {
+  if (!epoch_manager_ || reclaimer_.joinable()) return false;
+
+  reclaimer_interval_ = interval;
+  reclaimer_stop_ = false;
+  for (size_t i = 0; i < shard_count_; ++i) {
+    shards_[i].list.AttachReclaimer(max_lag);
+  }
+  reclaimer_ = std::thread(&ShardedGarbageList::ReclaimerLoop, this);
+  return true;
+}
+bool ShardedGarbageList::StopReclaimer() {
+  if (!reclaimer_.joinable()) return false;
+
+  for (size_t i = 0; i < shard_count_; ++i) shards_[i].list.DetachReclaimer();
+  {
+    std::unique_lock<std::mutex> lock(reclaimer_mutex_);
+    reclaimer_stop_ = true;
+  }
+  reclaimer_cv_.notify_one();
+  reclaimer_.join();
+  return true;
+}
+bool ShardedGarbageList::Drain(std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  bool empty = true;
+  for (size_t i = 0; i < shard_count_; ++i) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    left = std::max(left, std::chrono::milliseconds{0});
+    if (!shards_[i].list.Drain(left)) empty = false;
+  }
+  return empty;
+}
+void ShardedGarbageList::GetStats(ReclamationStats* stats) {
+  if (!epoch_manager_) {
+    *stats = ReclamationStats{};
+    return;
+  }
+  shards_[0].list.GetStats(stats);
+  for (size_t i = 1; i < shard_count_; ++i) {
+    ReclamationStats shard;
+    shards_[i].list.GetStats(&shard);
+    stats->pushes += shard.pushes;
+    stats->push_retries_unsafe += shard.push_retries_unsafe;
+    stats->push_retries_busy += shard.push_retries_busy;
+    stats->items_destroyed += shard.items_destroyed;
+    stats->outstanding += shard.outstanding;
+    stats->spills += shard.spills;
+    stats->overflow_segments += shard.overflow_segments;
+    for (size_t b = 0; b < ReclamationStats::kHistogramBuckets; ++b) {
+      stats->latency_epochs[b] += shard.latency_epochs[b];
+      stats->latency_ns[b] += shard.latency_ns[b];
+    }
+  }
+#ifdef EPOCH_STATS
+  stats->shard_steals = stats_.Sum(kStatShardSteals);
+#endif
+}
@@ -0,0 +1,149 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "garbage_list.h"
+#include "reclamation_stats.h"
+
+/// A GarbageList per CPU behind the IGarbageList interface, for workloads
+/// where many threads retire at once and a single ring's #tail_ (and the
+/// slots right behind it) would bounce between all of them.
+///
+/// Push() and Retire() go to the shard of the CPU the calling thread runs
+/// on, read from the thread's rseq area when the C library registered one
+/// and from sched_getcpu() otherwise. A thread that migrates between reading
+/// its CPU and pushing merely pushes to another CPU's shard, which is as
+/// safe as pushing to any shared GarbageList; it is only slower. So in the
+/// common case a push touches cachelines no other CPU uses, and its tail
+/// increment, while still atomic, is uncontended.
+///
+/// All shards stamp and reclaim with the same EpochManager. When a shard's
+/// ring is full of items that are not safe to reclaim yet, the pusher tries
+/// the rings of the following shards before it spills into its own shard's
+/// overflow (see GarbageList::SetOverflowLimit()).
+class ShardedGarbageList : public IGarbageList {
+ public:
+  /// Smallest ring a shard gets, whatever its share of Initialize()'s
+  /// \a item_count.
+  inline static const constexpr size_t kMinShardItems = 1024;
+
+  ShardedGarbageList();
+  virtual ~ShardedGarbageList();
+
+  ShardedGarbageList(const ShardedGarbageList&) = delete;
+  ShardedGarbageList& operator=(const ShardedGarbageList&) = delete;
+
+  /// Initialize \a shard_count shards (0 for one per configured CPU) that
+  /// share \a item_count ring slots. Each shard gets the largest power of
+  /// two not above its share, but at least kMinShardItems.
+  ///
+  /// \retval false \a epoch_manager was nullptr or a shard could not be
+  ///      initialized.
+#ifdef PMEM
+  bool Initialize(EpochManager* epoch_manager, PMEMobjpool* pool_,
+                  size_t item_count, size_t shard_count = 0);
+#else
+  bool Initialize(EpochManager* epoch_manager, size_t item_count = 128 * 1024,
+                  size_t shard_count = 0);
+#endif
+
+  /// Stop the reclaimer and uninitialize every shard; see
+  /// GarbageList::Uninitialize().
+  virtual bool Uninitialize();
+
+  /// Push onto the calling CPU's shard; see GarbageList::Push().
+  virtual bool Push(void* removed_item, DestroyCallback callback,
+                    void* context);
+
+  /// Stage the item in the calling thread's retire buffer for this list; see
+  /// GarbageList::Retire(). A thread has one buffer for the whole list,
+  /// however often it migrates, and each flush publishes it to the shard of
+  /// the CPU the thread runs on then. Falls back to Push() if the buffer is
+  /// full of items no shard could take.
+  bool Retire(void* removed_item, DestroyCallback callback, void* context);
+
+  /// Publish everything the calling thread has staged with Retire() to the
+  /// calling CPU's shard.
+  /// \retval false Some items could not be taken and are still staged.
+  bool FlushRetireBuffer();
+
+  /// GarbageList::SetOverflowLimit() for every shard; \a max_items is per
+  /// shard.
+  bool SetOverflowLimit(size_t max_items);
+
+  /// GarbageList::SetSlotSpread() for every shard.
+  bool SetSlotSpread(bool spread);
+
+  /// GarbageList::RegisterBatchDestroyCallback() for every shard.
+  bool RegisterBatchDestroyCallback(DestroyCallback callback,
+                                    BatchDestroyCallback batch_callback);
+
+  /// Start one background thread that, every \a interval, bumps the epoch
+  /// once and then sweeps every shard as its own reclaimer would; see
+  /// GarbageList::StartReclaimer(). \a max_lag applies per shard.
+  ///
+  /// \retval false The list is not initialized or a reclaimer already runs.
+  bool StartReclaimer(std::chrono::microseconds interval,
+                      uint64_t max_lag = 0);
+
+  /// Stop and join the reclaimer thread.
+  bool StopReclaimer();
+
+  /// GarbageList::Drain() every shard, all within \a timeout.
+  ///
+  /// \retval true Every shard was empty when Drain() returned.
+  bool Drain(std::chrono::milliseconds timeout);
+
+  /// Fill \a stats as GarbageList::GetStats() does, with the list counters
+  /// and gauges summed over all shards.
+  void GetStats(ReclamationStats* stats);
+
+  /// Number of shards.
+  size_t GetShardCount() { return shard_count_; }
+
+  /// Index of the shard the calling thread's pushes go to right now.
+  size_t GetCurrentShard();
+
+  /// Returns (a pointer to) the epoch manager shared by all shards.
+  EpochManager* GetEpoch() { return epoch_manager_; }
+
+ private:
+  /// Padded so no two shards' rings (or their tails) share a cacheline.
+  struct alignas(very_pm::kCacheLineSize) Shard {
+    GarbageList list;
+  };
+
+  /// CPU the calling thread runs on, or some stable per-thread number if
+  /// the kernel won't tell.
+  static size_t CurrentCpu();
+
+  /// Body of the reclaimer thread.
+  void ReclaimerLoop();
+
+  /// Publish a flushed retire buffer to the calling CPU's shard, and what
+  /// that shard cannot take to the others; see GarbageList::PublishBatch().
+  /// The buffers live in the first shard, which calls this to flush them.
+  size_t PublishBatch(const GarbageList::Item* items, size_t count,
+                      bool force);
+
+  friend class GarbageList;
+
+  EpochManager* epoch_manager_;
+  Shard* shards_;
+  size_t shard_count_;
+
+  /// See StartReclaimer().
+  std::thread reclaimer_;
+  std::chrono::microseconds reclaimer_interval_;
+  std::mutex reclaimer_mutex_;
+  std::condition_variable reclaimer_cv_;
+  bool reclaimer_stop_;
+
+#ifdef EPOCH_STATS
+  enum Stat { kStatShardSteals, kStatCount };
+  StatCounters<kStatCount> stats_;
+#endif
+};
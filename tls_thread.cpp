@@ -12,6 +12,21 @@ void Thread::RegisterTls(uint64_t *ptr, uint64_t val) {
   registry_[id]->emplace_back(ptr, val);
 }
 
+void Thread::UnregisterTls(uint64_t *ptr) {
+  auto id = std::this_thread::get_id();
+  std::unique_lock<std::mutex> lock(registryMutex_);
+  auto iter = registry_.find(id);
+  if (iter == registry_.end()) return;
+  auto *list = iter->second;
+  list->remove_if([ptr](const std::pair<uint64_t *, uint64_t> &entry) {
+    return entry.first == ptr;
+  });
+  if (list->empty()) {
+    delete list;
+    registry_.erase(iter);
+  }
+}
+
 void Thread::ClearTls(bool destroy) {
   std::unique_lock<std::mutex> lock(registryMutex_);
   auto iter = registry_.find(id_);
@@ -44,6 +44,11 @@ class Thread : public std::thread {
   /// @val - default value of the TLS variable
   static void RegisterTls(uint64_t *ptr, uint64_t val);
 
+  /// Forget a thread-local variable registered by the calling thread, e.g.
+  /// because the thread is about to exit and its TLS is going away
+  /// @ptr - pointer to the TLS variable
+  static void UnregisterTls(uint64_t *ptr);
+
   /// Clear/reset the entire global TLS registry covering all threads
   static void ClearRegistry(bool destroy = false);
 
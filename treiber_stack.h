@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include "garbage_list.h"
+
+/// Lock-free LIFO stack (Treiber) whose popped nodes are reclaimed through
+/// a GarbageList.
+///
+/// Pop() reads the top node's successor and value inside an EpochGuard, so
+/// the node can not be freed (and its address reused, which is what makes a
+/// plain CAS on the head ABA-prone) while any thread may still be looking
+/// at it.
+template <typename T>
+class TreiberStack {
+ public:
+  TreiberStack() : head_{nullptr}, epoch_manager_{}, garbage_list_{} {}
+  ~TreiberStack() { Uninitialize(); }
+
+  TreiberStack(const TreiberStack&) = delete;
+  TreiberStack& operator=(const TreiberStack&) = delete;
+
+  /// Use \a garbage_list, which must be initialized with \a epoch_manager,
+  /// to reclaim popped nodes.
+  bool Initialize(EpochManager* epoch_manager, GarbageList* garbage_list) {
+    if (epoch_manager_) return true;
+    if (!epoch_manager || !garbage_list) return false;
+    epoch_manager_ = epoch_manager;
+    garbage_list_ = garbage_list;
+    return true;
+  }
+
+  /// Delete the nodes still on the stack. No thread may use it any more;
+  /// popped nodes belong to the garbage list.
+  bool Uninitialize() {
+    if (!epoch_manager_) return true;
+    Node* node = head_.load(std::memory_order_relaxed);
+    while (node) {
+      Node* next = node->next;
+      delete node;
+      node = next;
+    }
+    head_.store(nullptr, std::memory_order_relaxed);
+    epoch_manager_ = nullptr;
+    garbage_list_ = nullptr;
+    return true;
+  }
+
+  void Push(const T& value) {
+    Node* node = new Node{value, head_.load(std::memory_order_relaxed)};
+    while (!head_.compare_exchange_weak(node->next, node,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+    }
+  }
+
+  /// Pop the top value into \a value.
+  /// \retval false The stack was empty.
+  bool Pop(T* value) {
+    PendingRetires pending(garbage_list_);
+    EpochGuard guard(epoch_manager_);
+    Node* node = head_.load(std::memory_order_acquire);
+    while (node && !head_.compare_exchange_weak(node, node->next,
+                                                std::memory_order_acquire,
+                                                std::memory_order_acquire)) {
+    }
+    if (!node) return false;
+    *value = node->value;
+    // Staged while protected and published when the guard goes away; if the
+    // list refuses it, pushed once the guard is gone.
+    pending.Retire(node, &TreiberStack::DestroyNode, nullptr);
+    return true;
+  }
+
+ private:
+  struct Node {
+    T value;
+
+    /// Fixed once the node is on the stack.
+    Node* next;
+  };
+
+  static void DestroyNode(void* context, void* node) {
+    (void)context;
+    delete static_cast<Node*>(node);
+  }
+
+  std::atomic<Node*> head_;
+  EpochManager* epoch_manager_;
+  GarbageList* garbage_list_;
+};
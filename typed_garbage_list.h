@@ -0,0 +1,279 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include "epoch_manager.h"
+#include "utils.h"
+
+/// Single-type reclamation queue with the destroy policy fixed at compile
+/// time.
+///
+/// GarbageList stores a callback and a context pointer with every item and
+/// goes through IGarbageList's virtual Push(), which makes its items 32 bytes
+/// (two per cache line) and keeps the destroy call opaque to the compiler.
+/// When everything pushed to a list has the same type, TypedGarbageList
+/// stores just the removal epoch and the pointer (16 bytes, four per cache
+/// line) and destroys items by calling \a Deleter directly, so Retire() and
+/// the deleter can be inlined into the caller.
+///
+/// The ring works like GarbageList's without a reclaimer or an overflow:
+/// every Retire() takes the next slot and destroys its previous occupant once
+/// that is safe, bumping the epoch as the EpochManager's advance policy asks,
+/// and fails rather than waiting when the ring is full. It lives in
+/// DRAM in all builds; persistent recovery is left to GarbageList. Tickets
+/// are spread over cachelines as in GarbageList::SetSlotSpread().
+///
+/// \tparam T Type of the retired objects.
+/// \tparam Deleter Stateless functor called as Deleter{}(T*) to destroy an
+///      object once no thread can still access it.
+/// \tparam kSplitEpochs Keep the removal epochs in a dense array of their
+///      own (eight per cache line) and the pointers in another, instead of
+///      an array of Items. A claim's CAS and a sweep's epoch checks then
+///      touch half as many lines, and the pointer line is only written once
+///      a slot is claimed.
+template <typename T, typename Deleter = std::default_delete<T>,
+          bool kSplitEpochs = false>
+class TypedGarbageList {
+ public:
+  /// One retired object in the ring.
+  struct Item {
+    /// Epoch in which the object was retired; 0 if the slot is empty and
+    /// #invalid_epoch while a thread is modifying it.
+    Epoch removal_epoch;
+
+    /// Object to destroy.
+    T* removed_item;
+  };
+  static_assert(sizeof(Item) == 16, "four items should fit in a cache line");
+
+  /// Sentinel epoch held by a slot while a thread is modifying it.
+  inline static const constexpr Epoch invalid_epoch = ~0llu;
+
+  /// Retire() gives up once this many ring slots in a row held objects that
+  /// were not safe to reclaim yet; see GarbageList::kSpillAfterUnsafeSlots.
+  inline static const constexpr uint32_t kGiveUpAfterUnsafeSlots = 64;
+
+  /// Slots whose epochs share a cacheline.
+  inline static const constexpr size_t kSlotsPerLine =
+      very_pm::kCacheLineSize / (kSplitEpochs ? sizeof(Epoch) : sizeof(Item));
+
+  TypedGarbageList()
+      : epoch_manager_{},
+        tail_{},
+        item_count_{},
+        ring_bits_{},
+        slot_rotation_{},
+        items_{},
+        epochs_{},
+        objects_{} {}
+  ~TypedGarbageList() { Uninitialize(); }
+
+  TypedGarbageList(const TypedGarbageList&) = delete;
+  TypedGarbageList& operator=(const TypedGarbageList&) = delete;
+
+  /// Initialize the list with room for \a item_count objects, which must be
+  /// a power of two, stamping them with epochs of \a epoch_manager.
+  ///
+  /// \retval false \a epoch_manager was nullptr, \a item_count was not a
+  ///      power of two, or allocation failed.
+  bool Initialize(EpochManager* epoch_manager, size_t item_count = 128 * 1024) {
+    if (epoch_manager_) return true;
+    if (!epoch_manager) return false;
+    if (!item_count || !IS_POWER_OF_TWO(item_count)) return false;
+
+    if constexpr (kSplitEpochs) {
+      if (posix_memalign((void**)&epochs_, very_pm::kCacheLineSize,
+                         sizeof(Epoch) * item_count)) {
+        return false;
+      }
+      if (posix_memalign((void**)&objects_, very_pm::kCacheLineSize,
+                         sizeof(T*) * item_count)) {
+        free(epochs_);
+        epochs_ = nullptr;
+        return false;
+      }
+      for (size_t i = 0; i < item_count; ++i) {
+        epochs_[i] = 0;
+        objects_[i] = nullptr;
+      }
+    } else {
+      if (posix_memalign((void**)&items_, very_pm::kCacheLineSize,
+                         sizeof(Item) * item_count)) {
+        return false;
+      }
+      for (size_t i = 0; i < item_count; ++i) new (&items_[i]) Item{};
+    }
+
+    item_count_ = item_count;
+    ring_bits_ = __builtin_ctzll(item_count);
+    tail_ = 0;
+    epoch_manager_ = epoch_manager;
+    SetSlotSpread(true);
+    return true;
+  }
+
+  /// Destroy every object still on the list, regardless of the epoch. No
+  /// thread may be accessing them any more.
+  bool Uninitialize() {
+    if (!epoch_manager_) return true;
+
+    for (size_t i = 0; i < item_count_; ++i) {
+      if (ObjectAt(i)) {
+        Deleter{}(ObjectAt(i));
+        ObjectAt(i) = nullptr;
+        EpochAt(i) = 0;
+      }
+    }
+    free(items_);
+    free(epochs_);
+    free(objects_);
+
+    items_ = nullptr;
+    epochs_ = nullptr;
+    objects_ = nullptr;
+    tail_ = 0;
+    item_count_ = 0;
+    epoch_manager_ = nullptr;
+    return true;
+  }
+
+  /// Retire \a removed_item, which must already be unreachable for threads
+  /// that enter a protected region from now on. It is destroyed with
+  /// \a Deleter once every thread protected at this point has left.
+  ///
+  /// \retval false kGiveUpAfterUnsafeSlots slots in a row held objects some
+  ///      protected thread (possibly the caller) may still see, so the ring
+  ///      is full; \a removed_item was not taken and still belongs to the
+  ///      caller, who may retry after leaving its protected region.
+  bool Retire(T* removed_item) {
+    Epoch removal_epoch = epoch_manager_->GetCurrentEpoch();
+    uint32_t unsafe = 0;
+    for (;;) {
+      int64_t ticket = tail_.fetch_add(1);
+      size_t slot = SlotOf(ticket);
+
+      // Roll the epoch over when the manager's advance policy says so.
+      if (epoch_manager_->ShouldAdvance(ticket, item_count_))
+        epoch_manager_->BumpCurrentEpoch();
+
+      ClaimResult result = TryRecycle(slot);
+      if (result == kClaimed) {
+        ObjectAt(slot) = removed_item;
+        *((volatile Epoch*)&EpochAt(slot)) = removal_epoch;
+        return true;
+      }
+      // More laps over a ring of unsafe objects won't free a slot.
+      unsafe = result == kClaimUnsafe ? unsafe + 1 : 0;
+      if (unsafe >= kGiveUpAfterUnsafeSlots) return false;
+    }
+  }
+
+  /// Destroy every object on the list that is safe to reclaim now.
+  /// \return The number of objects destroyed.
+  int32_t Scavenge() {
+    int32_t scavenged = 0;
+    for (size_t slot = 0; slot < item_count_; ++slot) {
+      Epoch epoch = EpochAt(slot);
+      if (epoch == 0 || epoch == invalid_epoch) continue;
+      if (TryRecycle(slot) != kClaimed) continue;
+      *((volatile Epoch*)&EpochAt(slot)) = 0;
+      ++scavenged;
+    }
+    return scavenged;
+  }
+
+  /// Put consecutive tickets two cachelines (of epochs, with kSplitEpochs)
+  /// apart (the default) or map them to consecutive slots; see
+  /// GarbageList::SetSlotSpread().
+  ///
+  /// \retval false Objects were retired already.
+  bool SetSlotSpread(bool spread) {
+    if (tail_.load(std::memory_order_relaxed)) return false;
+    uint32_t rotation = __builtin_ctzll(kSlotsPerLine) + 1;
+    slot_rotation_ = spread && ring_bits_ > rotation ? rotation : 0;
+    return true;
+  }
+
+  /// Number of ring slots, as passed to Initialize().
+  size_t GetItemCount() const { return item_count_; }
+
+ private:
+  /// Outcome of TryRecycle(); see GarbageList::ClaimResult.
+  enum ClaimResult {
+    kClaimed,
+
+    /// The slot is being modified by someone else.
+    kClaimBusy,
+
+    /// The slot's object is not safe to reclaim yet.
+    kClaimUnsafe,
+  };
+
+  Epoch& EpochAt(size_t slot) {
+    if constexpr (kSplitEpochs) {
+      return epochs_[slot];
+    } else {
+      return items_[slot].removal_epoch;
+    }
+  }
+  T*& ObjectAt(size_t slot) {
+    if constexpr (kSplitEpochs) {
+      return objects_[slot];
+    } else {
+      return items_[slot].removed_item;
+    }
+  }
+
+  /// Ring slot of \a ticket.
+  size_t SlotOf(int64_t ticket) {
+    uint64_t index = (ticket - 1) & (item_count_ - 1);
+    if (!slot_rotation_) return index;
+    return ((index << slot_rotation_) |
+            (index >> (ring_bits_ - slot_rotation_))) &
+           (item_count_ - 1);
+  }
+
+  /// Take \a slot for the calling thread, destroying its previous occupant
+  /// if there is one and it is safe to reclaim. On success the slot is left
+  /// at #invalid_epoch with its object cleared, and the caller must store a
+  /// new removal epoch.
+  ClaimResult TryRecycle(size_t slot) {
+    Epoch prior_epoch = EpochAt(slot);
+    if (prior_epoch == invalid_epoch) return kClaimBusy;
+    if (prior_epoch && !epoch_manager_->IsSafeToReclaim(prior_epoch) &&
+        !epoch_manager_->RefreshSafeToReclaimEpoch(prior_epoch)) {
+      return kClaimUnsafe;
+    }
+
+    Epoch result = CompareExchange64<Epoch>(&EpochAt(slot), invalid_epoch,
+                                            prior_epoch);
+    if (result != prior_epoch) return kClaimBusy;
+
+    if (prior_epoch) {
+      Deleter{}(ObjectAt(slot));
+      ObjectAt(slot) = nullptr;
+    }
+    return kClaimed;
+  }
+
+  /// EpochManager stamping and protecting the objects on this list.
+  EpochManager* epoch_manager_;
+
+  /// Ticket counter for ring slots; see SlotOf().
+  std::atomic<int64_t> tail_;
+
+  /// Capacity of the ring, a power of two.
+  size_t item_count_;
+
+  /// log2(#item_count_) and SlotOf()'s rotation; see SetSlotSpread().
+  uint32_t ring_bits_;
+  uint32_t slot_rotation_;
+
+  /// The ring of retired objects, unless kSplitEpochs.
+  Item* items_;
+
+  /// The ring's removal epochs and objects if kSplitEpochs.
+  Epoch* epochs_;
+  T** objects_;
+};